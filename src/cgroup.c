@@ -0,0 +1,181 @@
+/*
+ * This file is part of tiptop.
+ *
+ * Author: Erven ROHOU
+ * Copyright (c) 2012 Inria
+ *
+ * License: GNU General Public License version 2.
+ *
+ */
+
+/* Discovery of the control groups of the unified (v2) hierarchy. In
+   cgroup mode, rows represent cgroups instead of tasks: counters are
+   opened once per CPU with PERF_FLAG_PID_CGROUP, and count all tasks
+   of the cgroup (and its descendants), whatever their number and
+   lifetime. */
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "cgroup.h"
+
+/* Where the unified hierarchy is mounted: on /sys/fs/cgroup, or below
+   it on hosts that still use the legacy controllers ("hybrid"). */
+static const char* const roots[] = {
+  "/sys/fs/cgroup",
+  "/sys/fs/cgroup/unified"
+};
+
+static const char* root = NULL;
+
+
+/* Look for the unified hierarchy. Return 1 if found. */
+int cgroup_available()
+{
+  char name[100];
+  unsigned int i;
+
+  for(i=0; i < sizeof(roots) / sizeof(roots[0]); i++) {
+    snprintf(name, sizeof(name), "%s/cgroup.controllers", roots[i]);
+    if (access(name, R_OK) == 0) {
+      root = roots[i];
+      return 1;
+    }
+  }
+  return 0;
+}
+
+
+const char* cgroup_root()
+{
+  return root ? root : roots[0];
+}
+
+
+/* Does the cgroup (or a descendant) contain any task? */
+static int is_populated(int dir_fd)
+{
+  char  buf[128];
+  char* p;
+  int   fd, n;
+
+  fd = openat(dir_fd, "cgroup.events", O_RDONLY | O_CLOEXEC);
+  if (fd == -1)
+    return 0;
+  n = read(fd, buf, sizeof(buf) - 1);
+  close(fd);
+  if (n <= 0)
+    return 0;
+  buf[n] = '\0';
+  p = strstr(buf, "populated ");
+  return p && (p[10] == '1');
+}
+
+
+/* Append the populated sub-cgroups of 'dir_fd' (whose relative path
+   is 'path') to the array, recursively. 'dir_fd' is closed. */
+static void scan_dir(int dir_fd, const char* path,
+                     struct cgroup_entry** entries, int* num, int* num_alloc)
+{
+  DIR* dir;
+  struct dirent* ent;
+
+  dir = fdopendir(dir_fd);
+  if (!dir) {
+    close(dir_fd);
+    return;
+  }
+
+  while ((ent = readdir(dir))) {
+    struct cgroup_entry* e;
+    struct stat st;
+    int  child, n;
+
+    if ((ent->d_type != DT_DIR) || (ent->d_name[0] == '.'))
+      continue;
+
+    child = openat(dir_fd, ent->d_name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (child == -1)  /* removed meanwhile */
+      continue;
+    if ((fstat(child, &st) == -1) || !is_populated(child)) {
+      close(child);  /* empty subtree, skip it */
+      continue;
+    }
+
+    if (*num == *num_alloc) {
+      *num_alloc = *num_alloc ? 2 * *num_alloc : 64;
+      *entries = realloc(*entries, *num_alloc * sizeof(struct cgroup_entry));
+    }
+    e = &(*entries)[*num];
+    if (path[0])
+      n = snprintf(e->path, sizeof(e->path), "%s/%s", path, ent->d_name);
+    else
+      n = snprintf(e->path, sizeof(e->path), "%s", ent->d_name);
+    if (n >= (int)sizeof(e->path)) {  /* too deep, ignore */
+      close(child);
+      continue;
+    }
+    e->ino = st.st_ino;
+    e->uid = st.st_uid;
+    (*num)++;
+
+    scan_dir(child, e->path, entries, num, num_alloc);
+  }
+  closedir(dir);
+}
+
+
+/* List the populated cgroups below the root (excluded: it covers the
+   whole system). The array is grown as needed. Return the number of
+   entries. */
+int cgroup_scan(struct cgroup_entry** entries, int* num_alloc)
+{
+  int num = 0;
+  int fd = open(cgroup_root(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+  if (fd != -1)
+    scan_dir(fd, "", entries, &num, num_alloc);
+  return num;
+}
+
+
+/* Open 'file' in the cgroup 'path' (the directory itself if 'file' is
+   NULL). */
+int cgroup_open(const char* path, const char* file, int flags)
+{
+  char name[CGROUP_PATH_LEN + 64] = { 0 };
+
+  if (file)
+    snprintf(name, sizeof(name) - 1, "%s/%s/%s", cgroup_root(), path, file);
+  else
+    snprintf(name, sizeof(name) - 1, "%s/%s", cgroup_root(), path);
+  return open(name, flags | O_CLOEXEC);
+}
+
+
+/* Extract the user and system times (microseconds) from the content
+   of cpu.stat. Return -1 if they are not found. */
+int cgroup_parse_stat(const char* buf,
+                      unsigned long long* user, unsigned long long* system)
+{
+  int found = 0;
+
+  while (*buf) {
+    if (sscanf(buf, "user_usec %llu", user) == 1)
+      found++;
+    else if (sscanf(buf, "system_usec %llu", system) == 1)
+      found++;
+
+    buf = strchr(buf, '\n');
+    if (!buf)
+      break;
+    buf++;
+  }
+  return (found == 2) ? 0 : -1;
+}
@@ -0,0 +1,41 @@
+/*
+ * This file is part of tiptop.
+ *
+ * Author: Erven ROHOU
+ * Copyright (c) 2012 Inria
+ *
+ * License: GNU General Public License version 2.
+ *
+ */
+
+#ifndef _CGROUP_H
+#define _CGROUP_H
+
+#include <sys/types.h>
+
+#include "pmc.h"
+
+/* Older headers do not define it. */
+#ifndef PERF_FLAG_PID_CGROUP
+#define PERF_FLAG_PID_CGROUP (1U << 2)
+#endif
+
+#define CGROUP_PATH_LEN 256
+
+
+/* A populated cgroup of the unified hierarchy. */
+struct cgroup_entry {
+  char   path[CGROUP_PATH_LEN];  /* relative to the root */
+  ino_t  ino;                    /* identifies the cgroup */
+  uid_t  uid;                    /* owner of the directory */
+};
+
+
+int  cgroup_available(void);
+const char* cgroup_root(void);
+int  cgroup_scan(struct cgroup_entry** entries, int* num_alloc);
+int  cgroup_open(const char* path, const char* file, int flags);
+int  cgroup_parse_stat(const char* buf,
+                       unsigned long long* user, unsigned long long* system);
+
+#endif  /* _CGROUP_H */
@@ -48,4 +48,54 @@ struct expression {
 };
 
 
+/* Compiled form of a column expression: a postfix program, whose
+   operands are resolved once (see compile_expression). */
+typedef enum {
+  I_CONST,        /* push 'val' */
+  I_COUNTER,      /* push the value of counter 'arg' */
+  I_DELTA,        /* push the variation of counter 'arg' */
+  I_CPU_TOT,
+  I_CPU_SYS,
+  I_CPU_USER,
+  I_NUM_THREADS,
+  I_MUX_RATIO,
+  I_PROC_ID,
+  I_ADD,
+  I_SUB,
+  I_MUL,
+  I_DIV
+} opcode_t;
+
+
+typedef struct {
+  int    opcode;
+  int    arg;
+  double val;
+} instr_t;
+
+
+typedef struct {
+  int      num_instrs;
+  instr_t* instrs;
+} program_t;
+
+
+/* The programs of all the columns of a screen, merged: each distinct
+   operand or operation is a node, computed once per refresh whatever
+   the number of columns using it. Operands of a node are earlier
+   nodes. */
+typedef struct {
+  int    opcode;
+  int    arg;          /* counter index */
+  double val;          /* constant */
+  int    left, right;  /* operand nodes of operators */
+} node_t;
+
+
+typedef struct {
+  int     num_nodes;
+  node_t* nodes;
+} dag_t;
+
+
 #endif  /* _FORMULA_PARSER_H */
@@ -10,79 +10,98 @@
 
 
 
-/* Minimalist hash table to keep track of 'struct process'
-   entries. The key is the thread ID 'tid'.
+/* Hash table to keep track of 'struct process' entries. The key is
+   the thread ID 'tid'.
 
-   When the list of processes is realloc'd and the data actually moved
-   in memory, the hash table must be completely deleted and
-   rebuilt. This is costly, but should be rather rare.
+   Open addressing with linear probing: the slots are a single array
+   (power of 2), doubled when half full, and no allocation is needed
+   per entry. Deletion shifts back the following entries of the probe
+   sequence, hence no tombstones.
  */
 
 #include <assert.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 
 #include "config.h"
 #include "hash.h"
 
-#define NUM_HASH_KEYS 16  /* must be a power of 2 */
+#define INITIAL_HASH_SIZE 256  /* must be a power of 2 */
 
 struct hash_entry {
-  struct process* data;
-  struct hash_entry* next;
+  int key;
+  struct process* data;  /* NULL for an empty slot */
 };
 
-static struct hash_entry* hash_map[NUM_HASH_KEYS];
+static struct hash_entry* hash_map = NULL;
+static unsigned int hash_size = 0;
+static unsigned int hash_count = 0;
+static unsigned int hash_shift = 0;  /* 32 - log2(hash_size) */
 
 
-/* simplest possible hash function */
-static inline int hash(int x)
+/* Fibonacci hashing: tids are mostly consecutive, spread them. The
+   high bits of the product are the well mixed ones. */
+static inline unsigned int hash(int x)
 {
-  return x & (NUM_HASH_KEYS - 1);
+  return ((uint32_t)x * 2654435761u) >> hash_shift;
 }
 
 
-/* Just initialize the buckets to NULL */
+static void hash_alloc(unsigned int size)
+{
+  assert((size & (size - 1)) == 0);  /* power of 2 */
+  hash_map = calloc(size, sizeof(struct hash_entry));
+  hash_size = size;
+  hash_count = 0;
+  for(hash_shift = 32; size > 1; size >>= 1)
+    hash_shift--;
+}
+
+
+/* Allocate the table, empty. */
 void hash_init()
 {
-  int i;
-  assert((NUM_HASH_KEYS & (NUM_HASH_KEYS - 1)) == 0);  /* power of 2 */
-  for(i=0; i < NUM_HASH_KEYS; i++)
-    hash_map[i] = NULL;
+  hash_alloc(INITIAL_HASH_SIZE);
 }
 
 
-/* Deallocate all entries, and reset the buckets to NULL. */
+/* Deallocate the table. */
 void hash_fini()
 {
-  int i;
-  for(i=0; i < NUM_HASH_KEYS; i++) {
-    struct hash_entry* ptr = hash_map[i];
-    while (ptr) {
-      struct hash_entry* next = ptr->next;
-      free(ptr);
-      ptr = next;
-    }
-    hash_map[i] = NULL;
-  }
+  free(hash_map);
+  hash_map = NULL;
+  hash_size = 0;
+  hash_count = 0;
+  hash_shift = 0;
+}
+
+
+/* Double the size of the table, and insert again all entries. */
+static void hash_grow()
+{
+  struct hash_entry* old_map = hash_map;
+  const unsigned int old_size = hash_size;
+  unsigned int i;
+
+  hash_alloc(2 * old_size);
+  for(i=0; i < old_size; i++)
+    if (old_map[i].data)
+      hash_add(old_map[i].key, old_map[i].data);
+  free(old_map);
 }
 
 
 #ifdef ENABLE_DEBUG
-/* Dump all entries (skip NULL buckets). */
+/* Dump all entries (skip empty slots). */
 void hash_dump()
 {
-  int i;
+  unsigned int i;
   printf("---------------\n");
-  for(i=0; i < NUM_HASH_KEYS; i++) {
-    struct hash_entry* ptr = hash_map[i];
-    if (ptr)
-      printf("[%3d] ", i);
-    while(ptr) {
-      printf("%d ", ptr->data->tid);
-      ptr = ptr->next;
-    }
-    printf("\n");
+  for(i=0; i < hash_size; i++) {
+    if (hash_map[i].data)
+      printf("[%5u] %d (home %u)\n", i, hash_map[i].key,
+             hash(hash_map[i].key));
   }
 }
 #endif  /* ENABLE_DEBUG */
@@ -92,61 +111,58 @@ void hash_dump()
    present in the table, nothing happens. */
 void hash_add(int key, struct process* proc)
 {
-  struct hash_entry* new;
-  int h = hash(key);
-  struct hash_entry* ptr = hash_map[h];
+  unsigned int h;
+
+  if (2 * (hash_count + 1) > hash_size)  /* keep load factor <= 1/2 */
+    hash_grow();
 
-  while (ptr) {
-    if (ptr->data->tid == key)  /* already in */
+  for(h = hash(key); hash_map[h].data; h = (h + 1) & (hash_size - 1)) {
+    if (hash_map[h].key == key)  /* already in */
       return;
-    ptr = ptr->next;
   }
-  /* not found, insert in front */
-  new = malloc(sizeof(struct hash_entry));
-  new->data = proc;
-  new->next = hash_map[h];  /* next is current first element (from bucket) */
-  hash_map[h] = new;  /* bucket now points to new element */
+  hash_map[h].key = key;
+  hash_map[h].data = proc;
+  hash_count++;
 }
 
 
 /* Retrieve a process from the key */
 struct process* hash_get(int key)
 {
-  int h = hash(key);
-  struct hash_entry* ptr = hash_map[h];
+  unsigned int h;
 
-  while (ptr) {
-    if (ptr->data->tid == key)  /* found */
-      return ptr->data;
-    ptr = ptr->next;
+  for(h = hash(key); hash_map[h].data; h = (h + 1) & (hash_size - 1)) {
+    if (hash_map[h].key == key)  /* found */
+      return hash_map[h].data;
   }
   return NULL;  /* not found */
 }
 
 
-/* Delete an entry from the hash table */
-void hash_del(int key)
+/* Delete the entry of 'proc' from the hash table. Nothing happens if
+   the key maps to another process (the tid was reused, and the entry
+   now belongs to the new task), or is not present. */
+void hash_del(int key, const struct process* proc)
 {
-  int h = hash(key);
-  struct hash_entry* ptr = hash_map[h];
-  struct hash_entry* to_delete;
-
-  /* special case for 1st element */
-  if (ptr->data->tid == key) {
-    to_delete = ptr;
-    hash_map[h] = ptr->next;
-    free(to_delete);
-    return;
+  const unsigned int mask = hash_size - 1;
+  unsigned int hole, h;
+
+  for(hole = hash(key); hash_map[hole].data; hole = (hole + 1) & mask) {
+    if (hash_map[hole].key == key)
+      break;
   }
+  if (hash_map[hole].data != proc)
+    return;
 
-  while (ptr) {
-    if (ptr && ptr->next && ptr->next->data->tid == key) {  /* found */
-      to_delete = ptr->next;
-      ptr->next = to_delete->next;
-      free(to_delete);
-      return;
+  /* Move back the entries that follow in the run, unless their home
+     slot is between the hole (excluded) and their position. */
+  for(h = (hole + 1) & mask; hash_map[h].data; h = (h + 1) & mask) {
+    const unsigned int home = hash(hash_map[h].key);
+    if (((h - home) & mask) >= ((h - hole) & mask)) {
+      hash_map[hole] = hash_map[h];
+      hole = h;
     }
-    ptr = ptr->next;
   }
-  assert(0);
+  hash_map[hole].data = NULL;
+  hash_count--;
 }
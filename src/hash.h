@@ -18,6 +18,6 @@ void hash_init();
 void hash_fini();
 void hash_add(int key, struct process* proc);
 struct process* hash_get(int key);
-void hash_del(int key);
+void hash_del(int key, const struct process* proc);
 
 #endif  /* _HASH_H */
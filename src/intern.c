@@ -0,0 +1,119 @@
+/*
+ * This file is part of tiptop.
+ *
+ * Author: Erven ROHOU
+ * Copyright (c) 2012 Inria
+ *
+ * License: GNU General Public License version 2.
+ *
+ */
+
+/* Table of shared strings. All the threads of a process have the same
+   name and command line: instead of one copy per thread, they share a
+   single reference-counted copy. Equal strings have equal pointers. */
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "intern.h"
+
+struct str_entry {
+  struct str_entry* next;
+  unsigned int      hash;
+  int               refs;
+  char              str[];
+};
+
+static struct str_entry** buckets = NULL;
+static unsigned int num_buckets = 0;  /* power of 2 */
+static unsigned int num_entries = 0;
+
+
+/* FNV-1a */
+static unsigned int hash_string(const char* s)
+{
+  unsigned int h = 2166136261u;
+  while (*s) {
+    h ^= (unsigned char)*s++;
+    h *= 16777619u;
+  }
+  return h;
+}
+
+
+/* Double the number of buckets, and redistribute the entries. */
+static void grow()
+{
+  unsigned int new_num = num_buckets ? 2 * num_buckets : 64;
+  struct str_entry** new_buckets = calloc(new_num, sizeof(struct str_entry*));
+  unsigned int i;
+
+  for(i = 0; i < num_buckets; i++) {
+    struct str_entry* e = buckets[i];
+    while (e) {
+      struct str_entry* next = e->next;
+      unsigned int b = e->hash & (new_num - 1);
+      e->next = new_buckets[b];
+      new_buckets[b] = e;
+      e = next;
+    }
+  }
+  free(buckets);
+  buckets = new_buckets;
+  num_buckets = new_num;
+}
+
+
+/* Return the shared copy of 's', creating it if needed. Each call
+   must be balanced by a call to str_release. */
+const char* str_intern(const char* s)
+{
+  const unsigned int h = hash_string(s);
+  struct str_entry* e;
+  size_t len;
+
+  if (num_entries >= num_buckets)
+    grow();
+
+  for(e = buckets[h & (num_buckets - 1)]; e; e = e->next) {
+    if ((e->hash == h) && (strcmp(e->str, s) == 0)) {
+      e->refs++;
+      return e->str;
+    }
+  }
+
+  len = strlen(s);
+  e = malloc(sizeof(struct str_entry) + len + 1);
+  memcpy(e->str, s, len + 1);
+  e->hash = h;
+  e->refs = 1;
+  e->next = buckets[h & (num_buckets - 1)];
+  buckets[h & (num_buckets - 1)] = e;
+  num_entries++;
+  return e->str;
+}
+
+
+/* Drop a reference. The string is freed with the last one. */
+void str_release(const char* s)
+{
+  struct str_entry* e;
+  struct str_entry** prev;
+
+  if (!s)
+    return;
+
+  e = (struct str_entry*)(s - offsetof(struct str_entry, str));
+  assert(e->refs > 0);
+  if (--e->refs > 0)
+    return;
+
+  prev = &buckets[e->hash & (num_buckets - 1)];
+  while (*prev != e)
+    prev = &(*prev)->next;
+  *prev = e->next;
+  num_entries--;
+  free(e);
+}
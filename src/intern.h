@@ -0,0 +1,17 @@
+/*
+ * This file is part of tiptop.
+ *
+ * Author: Erven ROHOU
+ * Copyright (c) 2012 Inria
+ *
+ * License: GNU General Public License version 2.
+ *
+ */
+
+#ifndef _INTERN_H
+#define _INTERN_H
+
+const char* str_intern(const char* s);
+void str_release(const char* s);
+
+#endif  /* _INTERN_H */
@@ -32,10 +32,12 @@ static void usage(const char* name)
   fprintf(stderr, "\t-b             ignored, for compatibility with batch mode\n");
 #endif
   fprintf(stderr, "\t-c             use command line instead of process name\n");
+  fprintf(stderr, "\t--cgroup       one row per cgroup instead of per task\n");
   fprintf(stderr, "\t--cpu-min m    minimum %%CPU to display a process\n");
   fprintf(stderr, "\t-d delay       delay in seconds between refreshes\n");
   fprintf(stderr, "\t-E filename    file where errors are logged\n");
   fprintf(stderr, "\t--epoch        add epoch at beginning of each line\n");
+  fprintf(stderr, "\t--exits        account for the tasks that exit between refreshes\n");
 #ifdef ENABLE_DEBUG
   fprintf(stderr, "\t-g             debug\n");
 #endif
@@ -43,15 +45,19 @@ static void usage(const char* name)
   fprintf(stderr, "\t-H             show threads\n");
   fprintf(stderr, "\t-K --kernel    show kernel activity (only for root)\n");
   fprintf(stderr, "\t-i             also display idle processes\n");
+  fprintf(stderr, "\t--jobs n       sample the tasks with n threads\n");
   fprintf(stderr, "\t--list-screens display list of available screens\n");
   fprintf(stderr, "\t-n num         max number of refreshes\n");
+  fprintf(stderr, "\t--netlink      discover tasks with the proc connector\n");
   fprintf(stderr, "\t-o outfile     output file in batch mode\n");
   fprintf(stderr, "\t--only-conf    Disable default screen, only configuration\n");
   fprintf(stderr, "\t-p --pid pid|name  only display task with this PID/name\n");
+  fprintf(stderr, "\t--release d    release counters of tasks idle for d seconds\n");
   fprintf(stderr, "\t-S num         screen number to display\n");
   fprintf(stderr, "\t--sticky       keep final status of dead processes\n");
   fprintf(stderr, "\t--timestamp    add timestamp at beginning of each line\n");
   fprintf(stderr, "\t-u userid      only show user's processes\n");
+  fprintf(stderr, "\t--uring        batch the reads of a refresh with io_uring\n");
   fprintf(stderr, "\t-U             show user name\n");
   fprintf(stderr, "\t-v             print version and exit\n");
   fprintf(stderr, "\t--version      print legalese and exit\n");
@@ -70,6 +76,8 @@ void init_options(struct option* opt)
   opt->batch = 1;
 #endif
   opt->cpu_threshold = 0.00001;
+  opt->release_delay = 30;
+  opt->num_jobs = 1;
   opt->default_screen = 1;
   opt->delay = 2;
   opt->euid = geteuid();
@@ -182,11 +190,21 @@ void parse_command_line(int argc, char* argv[],
       }
     }
 
+    if (strcmp(argv[i], "--cgroup") == 0) {
+      options->cgroup = 1 - options->cgroup;
+      continue;
+    }
+
     if (strcmp(argv[i], "--epoch") == 0) {
       options->show_epoch = 1 - options->show_epoch;
       continue;
     }
 
+    if (strcmp(argv[i], "--exits") == 0) {
+      options->exits = 1 - options->exits;
+      continue;
+    }
+
     if (strcmp(argv[i], "-g") == 0) {
 #ifdef ENABLE_DEBUG
       options->debug = 1 - options->debug;
@@ -240,6 +258,16 @@ void parse_command_line(int argc, char* argv[],
       }
     }
 
+    if (strcmp(argv[i], "--netlink") == 0) {
+      options->netlink = 1 - options->netlink;
+      continue;
+    }
+
+    if (strcmp(argv[i], "--uring") == 0) {
+      options->uring = 1 - options->uring;
+      continue;
+    }
+
     if (strcmp(argv[i], "-o") == 0) {
       if (i+1 < argc) {
         int euid = geteuid();
@@ -284,6 +312,30 @@ void parse_command_line(int argc, char* argv[],
       }
     }
 
+    if (strcmp(argv[i], "--jobs") == 0) {
+      if (i+1 < argc) {
+        options->num_jobs = atoi(argv[i+1]);
+        i++;
+        continue;
+      }
+      else {
+        fprintf(stderr, "Missing number after --jobs.\n");
+        exit(EXIT_FAILURE);
+      }
+    }
+
+    if (strcmp(argv[i], "--release") == 0) {
+      if (i+1 < argc) {
+        options->release_delay = (float)atof(argv[i+1]);
+        i++;
+        continue;
+      }
+      else {
+        fprintf(stderr, "Missing delay after --release.\n");
+        exit(EXIT_FAILURE);
+      }
+    }
+
     if (strcmp(argv[i], "-S") == 0) {
       if (i+1 < argc) {
         char* endptr;
@@ -21,7 +21,9 @@ struct option {
   int    spawn_pos;
   float  delay;
   float  cpu_threshold;  /* CPU activity below which a thread is considered inactive */
+  float  release_delay;  /* idle time after which counters are released */
   int    max_iter;
+  int    num_jobs;  /* threads sampling the tasks (--jobs) */
   char*  only_name;
   int    only_pid;
   char*  watch_name;
@@ -32,13 +34,16 @@ struct option {
   FILE*  out;
 
   unsigned int    batch : 1;
+  unsigned int    cgroup : 1;
   unsigned int    command_done : 1;
   unsigned int    config_file : 1;
   unsigned int    debug : 1;
   unsigned int    default_screen : 1;
   unsigned int    help : 1;
   unsigned int    error : 2;
+  unsigned int    exits : 1;
   unsigned int    idle : 1;
+  unsigned int    netlink : 1;
   unsigned int    show_cmdline : 1;
   unsigned int    show_epoch : 1;
   unsigned int    show_kernel : 1;
@@ -46,6 +51,7 @@ struct option {
   unsigned int    show_timestamp : 1;
   unsigned int    show_user : 1;
   unsigned int    sticky : 1;
+  unsigned int    uring : 1;
 };
 
 
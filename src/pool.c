@@ -0,0 +1,199 @@
+/*
+ * This file is part of tiptop.
+ *
+ * Author: Erven ROHOU
+ * Copyright (c) 2012 Inria
+ *
+ * License: GNU General Public License version 2.
+ *
+ */
+
+/* Workers sampling the tasks in parallel (--jobs). The items of a run
+   are split in one shard per worker. Workers claim chunks of their own
+   shard first, then steal chunks from the shards of the others, so
+   that expensive tasks do not leave workers idle. Chunks are claimed
+   with an atomic increment: no lock is taken while items are
+   processed, only to start and finish a run. The caller is worker 0. */
+
+#include <config.h>
+
+#include <stdlib.h>
+
+#ifdef HAVE_LIBPTHREAD
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#endif
+
+#include "error.h"
+#include "pool.h"
+
+#ifdef HAVE_LIBPTHREAD
+
+#define CHUNK 16  /* items claimed at once */
+
+struct shard {
+  int next;  /* first item not claimed yet */
+  int end;
+} __attribute__((aligned(64)));  /* one cache line each */
+
+static int num_workers = 1;
+static pthread_t*    threads = NULL;
+static struct shard* shards = NULL;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  start_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t  done_cond = PTHREAD_COND_INITIALIZER;
+static unsigned int generation = 0;  /* number of runs started */
+static int num_running = 0;          /* workers still busy with the run */
+static int stop = 0;
+
+static void (*run_fn)(void*, int);
+static void* run_arg;
+
+
+static void work(int self)
+{
+  int k, i;
+
+  /* own shard first, then the others in turn */
+  for(k = 0; k < num_workers; k++) {
+    struct shard* const s = &shards[(self + k) % num_workers];
+
+    while ((i = __atomic_fetch_add(&s->next, CHUNK, __ATOMIC_RELAXED)) <
+           s->end) {
+      const int last = (i + CHUNK < s->end) ? i + CHUNK : s->end;
+      for(; i < last; i++)
+        run_fn(run_arg, i);
+    }
+  }
+}
+
+
+static void* worker(void* arg)
+{
+  const int self = (int)(intptr_t)arg;
+  unsigned int seen = 0;
+
+  for(;;) {
+    pthread_mutex_lock(&lock);
+    while ((generation == seen) && !stop)
+      pthread_cond_wait(&start_cond, &lock);
+    if (stop) {
+      pthread_mutex_unlock(&lock);
+      return NULL;
+    }
+    seen = generation;
+    pthread_mutex_unlock(&lock);
+
+    work(self);
+
+    pthread_mutex_lock(&lock);
+    if (--num_running == 0)
+      pthread_cond_signal(&done_cond);
+    pthread_mutex_unlock(&lock);
+  }
+}
+
+
+/* Start the workers: 'num_jobs' in total, the caller included. */
+void pool_init(int num_jobs)
+{
+  sigset_t all, old;
+  int i;
+
+  if (num_jobs <= 1)
+    return;
+
+  threads = malloc((num_jobs - 1) * sizeof(pthread_t));
+  shards = calloc(num_jobs, sizeof(struct shard));
+
+  /* signals are for the main thread */
+  sigfillset(&all);
+  pthread_sigmask(SIG_SETMASK, &all, &old);
+  for(i = 1; i < num_jobs; i++) {
+    if (pthread_create(&threads[i - 1], NULL, worker, (void*)(intptr_t)i)) {
+      error_printf("Could only start %d jobs\n", i);
+      break;
+    }
+  }
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+  num_workers = i;
+}
+
+
+void pool_fini()
+{
+  int i;
+
+  pthread_mutex_lock(&lock);
+  stop = 1;
+  pthread_cond_broadcast(&start_cond);
+  pthread_mutex_unlock(&lock);
+
+  for(i = 1; i < num_workers; i++)
+    pthread_join(threads[i - 1], NULL);
+  num_workers = 1;
+  free(threads);
+  free(shards);
+  threads = NULL;
+  shards = NULL;
+}
+
+
+/* Call fn(arg, i) for i from 0 to num-1, on all workers. Return when
+   all calls are done. Small runs are not worth waking the workers. */
+void pool_run(int num, void (*fn)(void* arg, int i), void* arg)
+{
+  int w;
+
+  if ((num_workers == 1) || (num < 2 * CHUNK)) {
+    for(w = 0; w < num; w++)
+      fn(arg, w);
+    return;
+  }
+
+  run_fn = fn;
+  run_arg = arg;
+  for(w = 0; w < num_workers; w++) {
+    shards[w].next = (long)num * w / num_workers;
+    shards[w].end = (long)num * (w + 1) / num_workers;
+  }
+
+  pthread_mutex_lock(&lock);
+  generation++;
+  num_running = num_workers - 1;
+  pthread_cond_broadcast(&start_cond);
+  pthread_mutex_unlock(&lock);
+
+  work(0);
+
+  /* the lock also publishes the results of the workers */
+  pthread_mutex_lock(&lock);
+  while (num_running)
+    pthread_cond_wait(&done_cond, &lock);
+  pthread_mutex_unlock(&lock);
+}
+
+#else  /* HAVE_LIBPTHREAD */
+
+void pool_init(int num_jobs)
+{
+  if (num_jobs > 1)
+    error_printf("No pthread support, --jobs ignored\n");
+}
+
+
+void pool_fini()
+{
+}
+
+
+void pool_run(int num, void (*fn)(void* arg, int i), void* arg)
+{
+  int i;
+  for(i = 0; i < num; i++)
+    fn(arg, i);
+}
+
+#endif  /* HAVE_LIBPTHREAD */
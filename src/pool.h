@@ -0,0 +1,18 @@
+/*
+ * This file is part of tiptop.
+ *
+ * Author: Erven ROHOU
+ * Copyright (c) 2012 Inria
+ *
+ * License: GNU General Public License version 2.
+ *
+ */
+
+#ifndef _POOL_H
+#define _POOL_H
+
+void pool_init(int num_jobs);
+void pool_fini();
+void pool_run(int num, void (*fn)(void* arg, int i), void* arg);
+
+#endif  /* _POOL_H */
@@ -0,0 +1,168 @@
+/*
+ * This file is part of tiptop.
+ *
+ * Author: Erven ROHOU
+ * Copyright (c) 2012 Inria
+ *
+ * License: GNU General Public License version 2.
+ *
+ */
+
+/* Event-driven task discovery. The kernel proc connector (netlink)
+   multicasts a message each time a task forks, execs or exits. When
+   the subscription succeeds, new tasks are learnt from these messages
+   and the full scan of /proc is no longer needed at each refresh.
+
+   Subscribing requires CAP_NET_ADMIN on most kernels. When the socket
+   cannot be set up, the caller falls back to scanning /proc. */
+
+#include <errno.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <linux/cn_proc.h>
+#include <linux/connector.h>
+#include <linux/netlink.h>
+
+#include "proc-events.h"
+
+/* Large receive buffer, we only drain the socket once per refresh. */
+#define RCVBUF_SIZE (4 * 1024 * 1024)
+
+/* Messages received but not yet consumed by proc_events_next. */
+static char  msg_buf[8192] __attribute__((aligned(NLMSG_ALIGNTO)));
+static int   msg_len = 0;
+static struct nlmsghdr* msg_ptr = NULL;
+
+
+/* Send a (un)subscription request to the proc connector. */
+static int proc_events_ctl(int fd, enum proc_cn_mcast_op op)
+{
+  char buf[NLMSG_SPACE(sizeof(struct cn_msg) + sizeof(op))]
+       __attribute__((aligned(NLMSG_ALIGNTO)));
+  struct nlmsghdr* nlh = (struct nlmsghdr*)buf;
+  struct cn_msg*   msg = NLMSG_DATA(nlh);
+
+  memset(buf, 0, sizeof(buf));
+  nlh->nlmsg_len = NLMSG_LENGTH(sizeof(struct cn_msg) + sizeof(op));
+  nlh->nlmsg_type = NLMSG_DONE;
+  nlh->nlmsg_pid = 0;
+
+  msg->id.idx = CN_IDX_PROC;
+  msg->id.val = CN_VAL_PROC;
+  msg->len = sizeof(op);
+  memcpy(msg->data, &op, sizeof(op));
+
+  if (send(fd, buf, nlh->nlmsg_len, 0) != nlh->nlmsg_len)
+    return -1;
+  return 0;
+}
+
+
+/* Open the netlink socket and subscribe to process events. Return the
+   socket, or -1 (with errno set) if not available. */
+int proc_events_open()
+{
+  struct sockaddr_nl addr;
+  int fd, size = RCVBUF_SIZE;
+
+  fd = socket(PF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_CONNECTOR);
+  if (fd == -1)
+    return -1;
+
+  /* Try hard to get a big buffer, bursts of forks are common. */
+  if (setsockopt(fd, SOL_SOCKET, SO_RCVBUFFORCE, &size, sizeof(size)) == -1)
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+
+  memset(&addr, 0, sizeof(addr));
+  addr.nl_family = AF_NETLINK;
+  addr.nl_groups = CN_IDX_PROC;
+  addr.nl_pid = 0;  /* let the kernel pick a unique port */
+
+  if ((bind(fd, (struct sockaddr*)&addr, sizeof(addr)) == -1) ||
+      (proc_events_ctl(fd, PROC_CN_MCAST_LISTEN) == -1)) {
+    int err = errno;
+    close(fd);
+    errno = err;
+    return -1;
+  }
+
+  msg_len = 0;
+  msg_ptr = NULL;
+  return fd;
+}
+
+
+/* Retrieve the next pending fork/exec/exit event, without blocking.
+   Return 1 when 'ev' is filled in, 0 when no event is pending, and -1
+   when events were lost (the socket buffer overflowed). In the latter
+   case, the caller must rescan /proc. */
+int proc_events_next(int fd, struct task_event* ev)
+{
+  for(;;) {
+    struct cn_msg*     msg;
+    struct proc_event  event;
+    struct proc_event* pe = &event;
+
+    if (!msg_ptr || !NLMSG_OK(msg_ptr, msg_len)) {
+      msg_len = recv(fd, msg_buf, sizeof(msg_buf), MSG_DONTWAIT);
+      if (msg_len <= 0) {
+        int lost = (msg_len == -1) && (errno == ENOBUFS);
+        msg_len = 0;
+        msg_ptr = NULL;
+        return lost ? -1 : 0;
+      }
+      msg_ptr = (struct nlmsghdr*)msg_buf;
+      continue;
+    }
+
+    msg = NLMSG_DATA(msg_ptr);
+    msg_ptr = NLMSG_NEXT(msg_ptr, msg_len);
+
+    if ((msg->id.idx != CN_IDX_PROC) || (msg->id.val != CN_VAL_PROC))
+      continue;
+
+    /* The event is only 4-byte aligned in the message (it has 64-bit
+       fields): copy it out. */
+    memset(&event, 0, sizeof(event));
+    memcpy(&event, msg->data,
+           (msg->len < sizeof(event)) ? msg->len : sizeof(event));
+
+    switch (pe->what) {
+    case PROC_EVENT_FORK:
+      ev->type = TASK_FORK;
+      ev->tid = pe->event_data.fork.child_pid;
+      ev->pid = pe->event_data.fork.child_tgid;
+      ev->ppid = pe->event_data.fork.parent_tgid;
+      return 1;
+
+    case PROC_EVENT_EXEC:
+      ev->type = TASK_EXEC;
+      ev->tid = pe->event_data.exec.process_pid;
+      ev->pid = pe->event_data.exec.process_tgid;
+      ev->ppid = 0;
+      return 1;
+
+    case PROC_EVENT_EXIT:
+      ev->type = TASK_EXIT;
+      ev->tid = pe->event_data.exit.process_pid;
+      ev->pid = pe->event_data.exit.process_tgid;
+      ev->ppid = 0;
+      return 1;
+
+    default:  /* uid, sid, comm... changes: not interesting */
+      break;
+    }
+  }
+}
+
+
+void proc_events_close(int fd)
+{
+  if (fd == -1)
+    return;
+  proc_events_ctl(fd, PROC_CN_MCAST_IGNORE);
+  close(fd);
+}
@@ -0,0 +1,37 @@
+/*
+ * This file is part of tiptop.
+ *
+ * Author: Erven ROHOU
+ * Copyright (c) 2012 Inria
+ *
+ * License: GNU General Public License version 2.
+ *
+ */
+
+#ifndef _PROC_EVENTS_H
+#define _PROC_EVENTS_H
+
+#include <sys/types.h>
+
+
+/* Kind of notification received from the kernel proc connector. */
+enum task_event_type {
+  TASK_FORK,   /* new process or new thread */
+  TASK_EXEC,   /* process replaced its image */
+  TASK_EXIT    /* task exited */
+};
+
+
+struct task_event {
+  enum task_event_type type;
+  pid_t tid;  /* thread concerned by the event */
+  pid_t pid;  /* process (thread group) it belongs to */
+  pid_t ppid; /* TASK_FORK: process of the parent, 0 otherwise */
+};
+
+
+int  proc_events_open(void);
+int  proc_events_next(int fd, struct task_event* ev);
+void proc_events_close(int fd);
+
+#endif  /* _PROC_EVENTS_H */
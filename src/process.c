@@ -11,54 +11,362 @@
 #include <assert.h>
 #include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <inttypes.h>
-#include <pwd.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
 #include <unistd.h>
 #include <sys/time.h>
 #include <sys/resource.h>
+#include <time.h>
 #include <papi.h>
 
+#include "cgroup.h"
 #include "error.h"
 #include "hash.h"
+#include "intern.h"
 #include "options.h"
 #include "pmc.h"
+#include "pool.h"
+#include "proc-events.h"
 #include "process.h"
 #include "screen.h"
 #include "spawn.h"
+#include "task-stat.h"
+#include "taskstats.h"
+#include "uring.h"
+#include "users.h"
 
 static int num_files = 0;
 static int num_files_limit = 0;
+static int num_cpus = 1;  /* cgroup counters are opened on each CPU */
+static int limit_reported = 0;
+
+/* A task must be this much more active (%CPU, moving average) than
+   another one to take its counters, so that they do not bounce. */
+#define EVICT_MARGIN 1.0
 
 static int   clk_tck;
 
+/* Times are read along with values, to scale multiplexed counters. */
+#define READ_FORMAT (PERF_FORMAT_TOTAL_TIME_ENABLED | \
+                     PERF_FORMAT_TOTAL_TIME_RUNNING)
+#define GROUP_READ_FORMAT (PERF_FORMAT_GROUP | PERF_FORMAT_ID)
+
+
+/* What the scans of /proc taught us about a process. It lets the next
+   scans skip /proc/PID/status and /proc/PID/task when nothing
+   changed. Entries are kept sorted by PID in the process list. */
+struct pid_info {
+  pid_t  pid;
+  ino_t  ino;          /* inode of /proc/PID, changes if the PID is reused */
+  uid_t  owner;        /* owner of /proc/PID, changes with setuid */
+  uid_t  uid;          /* from /proc/PID/status */
+  int    num_threads;  /* -1: status not read, 0: task directory to walk */
+  int    tracked;      /* passed the filters, threads are in the list */
+  int    generation;   /* last scan in which the PID was seen */
+  char   name[64];
+};
+
+
+/* Records are allocated by slabs, followed by their text rows, and
+   recycled through a free list: short-lived threads do not go through
+   malloc and free. Slabs are only released with the list. */
+#define PROC_SLAB_SIZE 64
+
+struct proc_slab {
+  struct proc_slab* next;
+  struct process    procs[PROC_SLAB_SIZE];
+  char              txt[];  /* PROC_SLAB_SIZE rows of row_len */
+};
+
+/* Tasks that exited since the last refresh (--exits), summed per
+   parent and command name: the tasks never seen, and the end of the
+   life of the others. The row is created at the first refresh with
+   exits, and removed after a refresh without. */
+struct exit_summary {
+  pid_t  ppid;
+  uid_t  uid;            /* of the first task */
+  const char* name;      /* "[exited] NAME", shared (see intern.c) */
+  struct process* row;   /* NULL until published */
+  unsigned long long utime;  /* microseconds, since the last refresh */
+  unsigned long long stime;
+  int    num_exits;
+  int    measured;       /* some task had counters */
+  uint64_t* sums;        /* increments of the counters of the screen */
+};
+
+
+#define RING_ENTRIES 256  /* reads submitted at once with --uring */
+
+
+/* One column per counter of the screen, no slot yet. */
+static void init_columns(struct counter_columns* const c, int num_columns)
+{
+  c->num_columns = num_columns;
+  c->num_slots = 0;
+  c->num_alloc_slots = 0;
+  c->fd = calloc(num_columns, sizeof(int*));
+  c->ids = calloc(num_columns, sizeof(uint64_t*));
+  c->values = calloc(num_columns, sizeof(uint64_t*));
+  c->prev_values = calloc(num_columns, sizeof(uint64_t*));
+  c->scaled = calloc(num_columns, sizeof(uint64_t*));
+  c->raw = calloc(num_columns, sizeof(uint64_t*));
+  c->enabled = calloc(num_columns, sizeof(uint64_t*));
+  c->running = calloc(num_columns, sizeof(uint64_t*));
+  c->papi = malloc(num_columns * sizeof(int));
+}
+
+
+/* Make room for 'num' more slots in the counter columns. They grow
+   geometrically. */
+static void grow_columns(struct counter_columns* const c, int num)
+{
+  int zz;
+
+  c->num_slots += num;
+  if (c->num_slots <= c->num_alloc_slots)
+    return;
+
+  while (c->num_alloc_slots < c->num_slots)
+    c->num_alloc_slots = c->num_alloc_slots ? 2 * c->num_alloc_slots : 256;
+  for(zz = 0; zz < c->num_columns; zz++) {
+    const size_t size = c->num_alloc_slots * sizeof(uint64_t);
+    c->fd[zz] = realloc(c->fd[zz], c->num_alloc_slots * sizeof(int));
+    c->ids[zz] = realloc(c->ids[zz], size);
+    c->values[zz] = realloc(c->values[zz], size);
+    c->prev_values[zz] = realloc(c->prev_values[zz], size);
+    c->scaled[zz] = realloc(c->scaled[zz], size);
+    c->raw[zz] = realloc(c->raw[zz], size);
+    c->enabled[zz] = realloc(c->enabled[zz], size);
+    c->running[zz] = realloc(c->running[zz], size);
+  }
+}
+
+
+static void free_columns(struct counter_columns* const c)
+{
+  int zz;
+
+  for(zz = 0; zz < c->num_columns; zz++) {
+    free(c->fd[zz]);
+    free(c->ids[zz]);
+    free(c->values[zz]);
+    free(c->prev_values[zz]);
+    free(c->scaled[zz]);
+    free(c->raw[zz]);
+    free(c->enabled[zz]);
+    free(c->running[zz]);
+  }
+  free(c->fd);
+  free(c->ids);
+  free(c->values);
+  free(c->prev_values);
+  free(c->scaled);
+  free(c->raw);
+  free(c->enabled);
+  free(c->running);
+  free(c->papi);
+}
+
+
+static struct process* alloc_proc(struct process_list* const list)
+{
+  struct process* p;
+
+  if (!list->free_procs) {
+    struct proc_slab* slab = malloc(sizeof(struct proc_slab) +
+                                    PROC_SLAB_SIZE * list->row_len);
+    const int first_slot = list->columns.num_slots;
+    int i;
+
+    grow_columns(&list->columns, PROC_SLAB_SIZE);
+    slab->next = list->slabs;
+    list->slabs = slab;
+    for(i = PROC_SLAB_SIZE - 1; i >= 0; i--) {
+      slab->procs[i].slot = first_slot + i;
+      slab->procs[i].txt = slab->txt + i * list->row_len;
+      slab->procs[i].next = list->free_procs;
+      list->free_procs = &slab->procs[i];
+    }
+  }
+  p = list->free_procs;
+  list->free_procs = p->next;
+  return p;
+}
+
+
+static void free_proc(struct process_list* const list, struct process* p)
+{
+  p->next = list->free_procs;
+  list->free_procs = p;
+}
+
 /////// PAPI Errors
 void handle_error (int retval)
 {
-    printf("PAPI error %d: %s\n", retval, PAPI_strerror(retval));
+  error_printf("PAPI error %d: %s\n", retval, PAPI_strerror(retval));
+}
+
+
+/* Return an eventset with the PAPI events of the screen, ready to be
+   attached: one given back by a dead task if any, otherwise a new one
+   built from the codes resolved with the screen. Return PAPI_NULL on
+   failure. */
+static int get_eventset(struct process_list* const list)
+{
+  int retval, EventSet = PAPI_NULL;
+
+  if (list->num_free_eventsets)
+    return list->free_eventsets[--list->num_free_eventsets];
+
+  retval = PAPI_create_eventset(&EventSet);
+  if (retval != PAPI_OK) {
+    handle_error(retval);
+    return PAPI_NULL;
+  }
+
+  retval = PAPI_assign_eventset_component(EventSet, 0);
+  if (retval == PAPI_OK)
+    retval = PAPI_set_multiplex(EventSet);
+  if ((retval == PAPI_OK) && list->per_process) {
+    PAPI_option_t opt;
+    memset(&opt, 0, sizeof(opt));
+    opt.inherit.eventset = EventSet;
+    opt.inherit.inherit = PAPI_INHERIT_ALL;
+    retval = PAPI_set_opt(PAPI_INHERIT, &opt);
+  }
+  if (retval == PAPI_OK)
+    retval = PAPI_add_events(EventSet, list->papi_codes, list->num_papi);
+
+  if (retval != PAPI_OK) {
+    handle_error(retval);
+    PAPI_cleanup_eventset(EventSet);
+    PAPI_destroy_eventset(&EventSet);
+    list->num_papi = 0;  /* same for all tasks, do not try again */
+    return PAPI_NULL;
+  }
+  return EventSet;
+}
+
+
+/* The task is gone: keep its eventset for the next new task. It only
+   needs to be stopped and detached. */
+static void put_eventset(struct process_list* const list,
+                         struct process* const p)
+{
+  int state = 0;
+
+  if ((PAPI_state(p->papi_eventset, &state) == PAPI_OK) &&
+      (state & PAPI_RUNNING))
+    PAPI_stop(p->papi_eventset, NULL);
+
+  if (PAPI_detach(p->papi_eventset) == PAPI_OK) {
+    if (list->num_free_eventsets == list->num_alloc_eventsets) {
+      list->num_alloc_eventsets = list->num_alloc_eventsets ?
+        2 * list->num_alloc_eventsets : 64;
+      list->free_eventsets = realloc(list->free_eventsets,
+                                     list->num_alloc_eventsets * sizeof(int));
+    }
+    list->free_eventsets[list->num_free_eventsets++] = p->papi_eventset;
+  }
+  else {  /* unknown state, start again from scratch */
+    PAPI_cleanup_eventset(p->papi_eventset);
+    PAPI_destroy_eventset(&p->papi_eventset);
+  }
+  p->papi_eventset = PAPI_NULL;
 }
 
 /*
- * Build the (empty) list of processes/threads.
+ * Build the (empty) list of processes/threads. When threads are not
+ * displayed, counters are only attached once per process and
+ * inherited by the threads created later. The state of the tasks is
+ * sized for the counters and the columns of the screen.
  */
-struct process_list* init_proc_list()
+struct process_list* init_proc_list(const screen_t* const screen,
+                                    const struct option* const options)
 {
   struct process_list* l;
   char  name[100] = { 0 };  /* needs to fit the name /proc/xxxx/limits */
   char  line[100];
   FILE* f;
+  int   i;
 
   clk_tck = sysconf(_SC_CLK_TCK);
+  num_cpus = sysconf(_SC_NPROCESSORS_CONF);
+  if (num_cpus < 1)
+    num_cpus = 1;
 
   l = malloc(sizeof(struct process_list));
   l->processes = NULL;
-  l->num_alloc = 20;
+  l->slabs = NULL;
+  l->free_procs = NULL;
+  init_columns(&l->columns, screen->num_counters);
+
+  /* the eventset of every task has the PAPI events of the screen */
+  l->papi_codes = malloc(screen->num_counters * sizeof(int));
+  l->num_papi = 0;
+  for(i = 0; i < screen->num_counters; i++) {
+    l->columns.papi[i] = screen->counters[i].papi_idx;
+    if (screen->counters[i].papi_idx != -1)
+      l->papi_codes[l->num_papi++] = screen->counters[i].papi_code;
+  }
+  l->free_eventsets = NULL;
+  l->num_free_eventsets = 0;
+  l->num_alloc_eventsets = 0;
+
+  l->ring = NULL;
+  if (options->uring) {
+    l->ring = uring_open(RING_ENTRIES);
+    if (!l->ring)
+      error_printf("io_uring not available, reading files one by one\n");
+  }
+  l->io_buf = NULL;
+  l->io_res = NULL;
+  /* a group read: nr, time enabled, time running, (value, id) pairs */
+  l->io_stride = STAT_BUF_LEN + (3 + 2*screen->num_counters) * sizeof(uint64_t);
+  l->num_alloc_io = 0;
+
+  /* Rows are sized for the worst case: the header changes with the
+     options toggled live (user column), and values may be wider than
+     their format. */
+  l->row_len = TXT_LEN;
+  l->num_alloc = 64;
   l->proc_ptrs = malloc(l->num_alloc * sizeof(struct process*));
   l->num_tids = 0;
   l->most_recent_pid = 0;
+  l->events_fd = -1;
+  l->events_failed = 0;
+  l->events_rescan = 0;
+  l->cgroups = options->cgroup;
+  l->exit_fd = l->cgroups ? -1 : epoll_create1(EPOLL_CLOEXEC);
+  l->taskstats_fd = -1;
+  if (options->exits && !l->cgroups) {
+    l->taskstats_fd = taskstats_open();
+    if (l->taskstats_fd == -1)
+      error_printf("Could not subscribe to taskstats (%s), "
+                   "exited tasks not accounted for\n", strerror(errno));
+  }
+  l->summaries = NULL;
+  l->num_summaries = 0;
+  l->num_alloc_summaries = 0;
+  gettimeofday(&l->last_fold, NULL);
+  l->per_process = !options->show_threads && !l->cgroups;
+  l->group_reads = 1;
+  l->cgroup_entries = NULL;
+  l->num_alloc_cgroups = 0;
+  l->cgroup_collisions = 0;
+  l->pids = NULL;
+  l->num_pids = 0;
+  l->num_sorted_pids = 0;
+  l->num_alloc_pids = 0;
+  l->scan_generation = 0;
 
   hash_init();
 
@@ -95,28 +403,183 @@ struct process_list* init_proc_list()
 }
 
 
-/* Free memory for all fields of the process. */
-static void done_proc(struct process* const p)
-{
-  int val_idx;
-  if (p->papi_eventset!=-1) {
-      PAPI_cleanup_eventset(p->papi_eventset);
-      PAPI_destroy_eventset(&(p->papi_eventset));
-  }
-  
-  if (p->cmdline)
-    free(p->cmdline);
-  free(p->name);
-  free(p->txt);
-  if (p->username)
-    free(p->username);
-
-  for(val_idx=0; val_idx < p->num_events; val_idx++) {
-    if (p->fd[val_idx] != -1) {
-      close(p->fd[val_idx]);
+/* Name of the stat file of the task. In per-process mode, the main
+   thread reads /proc/PID/stat, which covers all threads of the
+   process, dead ones included. Cgroups (whose path is kept as command
+   line) provide cpu.stat. */
+static void stat_file_name(const struct process_list* const list,
+                           const struct process* const p,
+                           char* name, int size)
+{
+  if (list->cgroups)
+    snprintf(name, size - 1, "%s/%s/cpu.stat", cgroup_root(), p->cmdline);
+  else if (list->per_process && (p->pid == p->tid))
+    snprintf(name, size - 1, "/proc/%d/stat", p->pid);
+  else
+    snprintf(name, size - 1, "/proc/%d/task/%d/stat", p->pid, p->tid);
+}
+
+
+/* Read the stat file of the task in 'buf' (nul-terminated). The file
+   is kept open, and simply read again from the start at each
+   refresh. Return the number of bytes read, or -1 when the task is
+   gone. */
+static int read_task_stat(const struct process_list* const list,
+                          struct process* const p, char* buf, int size)
+{
+  int n;
+
+  if (p->stat_fd != -1) {
+    n = pread(p->stat_fd, buf, size - 1, 0);
+  }
+  else {  /* no handle (files limit), open it each time */
+    char name[CGROUP_PATH_LEN + 50] = { 0 };
+    int  fd;
+    stat_file_name(list, p, name, sizeof(name));
+    fd = open(name, O_RDONLY);
+    if (fd == -1)
+      return -1;
+    n = read(fd, buf, size - 1);
+    close(fd);
+  }
+  if (n <= 0)  /* ESRCH: the task has been reaped */
+    return -1;
+  buf[n] = '\0';
+  return n;
+}
+
+
+static void close_stat(struct process* const p)
+{
+  if (p->stat_fd != -1) {
+    close(p->stat_fd);
+    num_files--;
+    p->stat_fd = -1;
+  }
+}
+
+
+static void close_pidfd(struct process* const p)
+{
+  if (p->pidfd != -1) {
+    close(p->pidfd);  /* also leaves the epoll set */
+    num_files--;
+    p->pidfd = -1;
+  }
+}
+
+
+/* Close the counters attached to the task (or cgroup). */
+static void close_counters(struct process_list* const list,
+                           struct process* const p)
+{
+  struct counter_columns* const c = &list->columns;
+  int zz;
+
+  for(zz=0; zz < p->num_events; zz++) {
+    if (c->fd[zz][p->slot] != -1) {
+      close(c->fd[zz][p->slot]);
       num_files--;
+      c->fd[zz][p->slot] = -1;
+    }
+  }
+  if (p->cpu_fd) {
+    for(zz=0; zz < p->num_events * num_cpus; zz++) {
+      if (p->cpu_fd[zz] != -1) {
+        close(p->cpu_fd[zz]);
+        num_files--;
+      }
     }
+    free(p->cpu_fd);
+    p->cpu_fd = NULL;
+  }
+}
+
+
+/* Free memory for all fields of the process. */
+static void done_proc(struct process_list* const list,
+                      struct process* const p)
+{
+  if (p->papi_eventset != PAPI_NULL)
+    put_eventset(list, p);
+
+  str_release(p->cmdline);
+  str_release(p->name);
+
+  close_counters(list, p);
+  close_stat(p);
+  close_pidfd(p);
+}
+
+
+static void read_counters(struct process_list* const list,
+                          struct process* const p);
+
+
+/* Summary of the exited tasks of parent 'ppid' called 'comm', created
+   if needed. */
+static struct exit_summary* find_summary(struct process_list* const list,
+                                         pid_t ppid, uid_t uid,
+                                         const char* comm)
+{
+  struct exit_summary* s;
+  char name[64];
+  int  i;
+
+  snprintf(name, sizeof(name), "[exited] %s", comm);
+  for(i = 0; i < list->num_summaries; i++) {
+    s = &list->summaries[i];
+    if ((s->ppid == ppid) && (strcmp(s->name, name) == 0))
+      return s;
+  }
+
+  if (list->num_summaries == list->num_alloc_summaries) {
+    list->num_alloc_summaries = list->num_alloc_summaries ?
+                                2 * list->num_alloc_summaries : 16;
+    list->summaries = realloc(list->summaries, list->num_alloc_summaries *
+                              sizeof(struct exit_summary));
   }
+  s = &list->summaries[list->num_summaries++];
+  memset(s, 0, sizeof(*s));
+  s->ppid = ppid;
+  s->uid = uid;
+  s->name = str_intern(name);
+  s->sums = calloc(list->columns.num_columns, sizeof(uint64_t));
+  return s;
+}
+
+
+/* Last read of the counters of a task that exited (--exits): what it
+   counted since the last refresh goes to its summary. */
+static void fold_counters(struct process_list* const list,
+                          struct process* const p)
+{
+  const struct counter_columns* const c = &list->columns;
+  struct exit_summary* s;
+  int zz;
+
+  read_counters(list, p);
+  s = find_summary(list, p->ppid, p->uid, p->name);
+  for(zz = 0; zz < p->num_events; zz++) {
+    if (c->values[zz][p->slot] != 0xffffffff)
+      s->sums[zz] += c->values[zz][p->slot] - c->prev_values[zz][p->slot];
+  }
+  s->measured = 1;
+}
+
+
+/* The task is gone: mark it dead, and give its files back. The record
+   stays in the list until compact_proc_list. */
+static void retire_task(struct process_list* const list,
+                        struct process* const p)
+{
+  if ((list->taskstats_fd != -1) && !p->dead && !p->detached &&
+      p->num_events)
+    fold_counters(list, p);
+  p->dead = 1;
+  close_counters(list, p);
+  close_stat(p);
+  close_pidfd(p);
 }
 
 
@@ -126,16 +589,41 @@ static void done_proc(struct process* const p)
 void done_proc_list(struct process_list* list)
 {
   struct process* p;
+  int i;
 
   assert(list && list->proc_ptrs);
-  p = list->processes;
-  while (p) {
-    struct process* old = p;
-    done_proc(p);
-    p = p->next;
-    free(old);
+  for(p = list->processes; p; p = p->next)
+    done_proc(list, p);
+  while (list->slabs) {
+    struct proc_slab* slab = list->slabs;
+    list->slabs = slab->next;
+    free(slab);
   }
+  free_columns(&list->columns);
 
+  while (list->num_free_eventsets) {
+    int EventSet = list->free_eventsets[--list->num_free_eventsets];
+    PAPI_cleanup_eventset(EventSet);
+    PAPI_destroy_eventset(&EventSet);
+  }
+  free(list->free_eventsets);
+  free(list->papi_codes);
+
+  uring_close(list->ring);
+  free(list->io_buf);
+  free(list->io_res);
+
+  proc_events_close(list->events_fd);
+  if (list->exit_fd != -1)
+    close(list->exit_fd);
+  taskstats_close(list->taskstats_fd);
+  for(i = 0; i < list->num_summaries; i++) {
+    str_release(list->summaries[i].name);
+    free(list->summaries[i].sums);
+  }
+  free(list->summaries);
+  free(list->pids);
+  free(list->cgroup_entries);
   free(list->proc_ptrs);
   free(list);
   hash_fini();
@@ -179,431 +667,1718 @@ static char* get_cmdline(int pid, char* result, int size)
 }
 
 
-void new_processes(struct process_list* const list,
-                   const screen_t* const screen,
-                   const struct option* const options)
+/* Set up the attributes shared by all the counters we attach. In
+   per-process mode, counters also count the threads (and child
+   processes) created after they are attached. Counters are not
+   pinned: when there are more events than hardware counters, the
+   kernel multiplexes them, and values are scaled (see
+   scale_counter). */
+static void init_events_attr(const struct process_list* const list,
+                             struct STRUCT_NAME* events,
+                             const struct option* const options)
 {
-  struct dirent* pid_dirent;
-  DIR*           pid_dir;
-  int            num_tids, val, n;
-  struct STRUCT_NAME events = {0, };
-  FILE*          f;
-  uid_t          my_uid = -1;
+  events->disabled = 0;
+  events->inherit = list->per_process;
+  events->exclude_hv = 1;
+  /* events->exclude_idle = 1; ?? */
+  if (options->show_kernel == 0)
+    events->exclude_kernel = 1;
+}
 
-  const int cpu = -1;
-  const int grp = -1;
-  const int flags = 0;
 
-  /* To avoid scanning the entire /proc directory, we first check if
-     any process has been created since last time. /proc/loadavg
-     contains the PID of the most recent process. We compare with our
-     own most recent. */
-  f = fopen("/proc/loadavg", "r");
-  n = fscanf(f, "%*f %*f %*f %*d/%*d %d", &val);
-  fclose(f);
-  /* if no new process has been created since last time, just quit. */
-  if ((n == 1) && (val == list->most_recent_pid))
-    return;
+/* Allocate the record of a new row, insert it in the list and fill in
+   what does not depend on how the row is monitored. Rows of tasks and
+   cgroups are then added to the hash table, summaries are not. */
+static struct process* new_record(struct process_list* const list,
+                                  pid_t tid, pid_t pid, uid_t uid,
+                                  int num_threads, int num_events,
+                                  const char* proc_name, const char* cmdline)
+{
+  struct counter_columns* const c = &list->columns;
+  int   zz;
+  struct process* ptr;
+
+  /* allocate memory, the text row comes with it */
+  ptr = alloc_proc(list);
+
+  /* insert into list of processes */
+  ptr->next = list->processes;
+  list->processes = ptr;
+
+  /* update helper data structures */
+  if (list->num_tids == list->num_alloc) {
+    list->num_alloc *= 2;
+    list->proc_ptrs = realloc(list->proc_ptrs,
+                              list->num_alloc*sizeof(struct process*));
+  }
+  list->proc_ptrs[list->num_tids] = ptr;
+  list->num_tids++;
+
+  /* fill in information for new process */
+  ptr->tid = tid;
+  ptr->pid = pid;
+  ptr->ppid = 0;
+  ptr->uid = uid;
+  ptr->proc_id = -1;
+  ptr->dead = 0;
+#if 0
+  ptr->attention = 0;
+#endif
+  ptr->u.d = 0.0;
+
+  ptr->username = user_name(uid);
+
+  ptr->num_threads = (short)num_threads;
+  ptr->cmdline = str_intern(cmdline);
+  ptr->name = str_intern(proc_name);
+  ptr->timestamp.tv_sec = 0;
+  ptr->timestamp.tv_usec = 0;
+  ptr->prev_cpu_time_s = 0;
+  ptr->prev_cpu_time_u = 0;
+  ptr->cpu_percent = 0.0;
+  ptr->cpu_percent_s = 0.0;
+  ptr->cpu_percent_u = 0.0;
+  ptr->cpu_avg = 0.0;
+  ptr->detached = 0;
+  ptr->exited = 0;
+  ptr->summary = 0;
+  ptr->last_active = time(NULL);
+  ptr->starttime = 0;
+  ptr->ino = 0;
+
+  ptr->num_events = num_events;
+  for(zz = 0; zz < ptr->num_events; zz++) {
+    c->fd[zz][ptr->slot] = -1;
+    c->ids[zz][ptr->slot] = 0;
+    c->values[zz][ptr->slot] = 0;
+    c->prev_values[zz][ptr->slot] = 0;
+    c->scaled[zz][ptr->slot] = 0;
+    c->raw[zz][ptr->slot] = 0;
+    c->enabled[zz][ptr->slot] = 0;
+    c->running[zz][ptr->slot] = 0;
+  }
+  ptr->group_leader = -1;
+  ptr->mux_ratio = 1.0;
+  ptr->papi_eventset = PAPI_NULL;
+  ptr->cpu_fd = NULL;
+  ptr->stat_fd = -1;
+  ptr->pidfd = -1;
+  return ptr;
+}
 
-  list->most_recent_pid = val;
 
-  num_tids = list->num_tids;
+/* Watch the exit of process 'p' (its main thread) with a pidfd, see
+   release_exited. Without pidfd_open (before Linux 5.3), exits are
+   noticed at the next refresh. */
+static void watch_exit(struct process_list* const list,
+                       struct process* const p)
+{
+  struct epoll_event ev;
 
-  events.disabled = 0;
-  events.pinned = 1;
-  events.exclude_hv = 1;
-  /* events.exclude_idle = 1; ?? */
-  if (options->show_kernel == 0)
-    events.exclude_kernel = 1;
+#ifdef __NR_pidfd_open
+  p->pidfd = syscall(__NR_pidfd_open, p->pid, 0);
+#else
+  errno = ENOSYS;
+#endif
+  if (p->pidfd == -1) {
+    if (errno == ENOSYS) {  /* do not try again */
+      close(list->exit_fd);
+      list->exit_fd = -1;
+    }
+    return;
+  }
+  num_files++;
 
-  /* check all directories of /proc */
-  pid_dir = opendir("/proc");
-  while ((pid_dirent = readdir(pid_dir))) {
-    int   uid, pid, num_threads, req_info;
-    char  name[50] = { 0 }; /* needs to fit /proc/xxxx/{status,cmdline} */
-    char  line[100]; /* line of /proc/xxxx/status */
-    char  proc_name[100];
-    int   skip_by_pid, skip_by_user;
-    char  cmdline[100];
+  ev.events = EPOLLIN;
+  ev.data.ptr = p;
+  if (epoll_ctl(list->exit_fd, EPOLL_CTL_ADD, p->pidfd, &ev) == -1)
+    close_pidfd(p);
+}
 
-    if (pid_dirent->d_type != DT_DIR)  /* not a directory */
-      continue;
 
-    if ((pid = atoi(pid_dirent->d_name)) == 0)  /* not a number */
-      continue;
+/* Open counter 'zz' of the task, in the group of the task if it has
+   one, or as leader of a new group. */
+static int open_counter(struct process_list* const list,
+                        struct process* const p,
+                        struct STRUCT_NAME* events,
+                        int zz, int cpu, int grp, unsigned long flags)
+{
+  struct counter_columns* const c = &list->columns;
+  int fd;
 
-    snprintf(name, sizeof(name) - 1, "/proc/%d/status", pid);
-    f = fopen(name, "r");
-    if (!f)
-      continue;
+  if (!(events->read_format & PERF_FORMAT_GROUP))  /* independent counters */
+    return sys_perf_counter_open(events, p->tid, cpu, grp, flags);
 
-    /* collect basic information about process */
-    req_info = 3;  /* need 3 pieces of information */
-    while (fgets(line, sizeof(line), f) && req_info) {
-      /* read the name now, since we will encounter it before Uid anyway */
-      if (strncmp(line, "Name:", 5) == 0) {
-        sscanf(line, "%*s %s", proc_name);
-        req_info--;
-      }
-      if (strncmp(line, "Uid:", 4) == 0) {
-        sscanf(line, "%*s %d", &uid);
-        req_info--;
-      }
-      if (strncmp(line, "Threads:", 8) == 0) {
-        sscanf(line, "%*s %d", &num_threads);
-        req_info--;
-      }
+  if (p->group_leader != -1) {
+    fd = sys_perf_counter_open(events, p->tid, cpu,
+                               c->fd[p->group_leader][p->slot], flags);
+  }
+  else {
+    fd = sys_perf_counter_open(events, p->tid, cpu, grp, flags);
+    if ((fd == -1) && (errno == EINVAL)) {
+      /* Group reads are refused with these attributes (such as
+         inherited counters on older kernels): fall back to
+         independent counters for good. */
+      events->read_format = READ_FORMAT;
+      fd = sys_perf_counter_open(events, p->tid, cpu, grp, flags);
+      if (fd != -1)
+        list->group_reads = 0;
+      else  /* not the reason, the next counter may lead the group */
+        events->read_format = READ_FORMAT | GROUP_READ_FORMAT;
+      return fd;
     }
-    fclose(f);
+    if (fd != -1)
+      p->group_leader = zz;
+  }
 
-    if (req_info != 0) {  /* could not read all 3 info. Process is gone? */
-      error_printf("Could not read info for process %d (gone already?)\n", pid);
-      continue;
-    }
+  /* The ID identifies the values returned by the group read. */
+  if ((fd != -1) && (ioctl(fd, PERF_EVENT_IOC_ID, &c->ids[zz][p->slot]) == -1))
+    c->ids[zz][p->slot] = 0;
+  return fd;
+}
 
-    cmdline[0] = '\0';
-    skip_by_pid = 0;
-    /* if "only" filter is set */
-    if (options->only_pid && (pid != options->only_pid))
-      skip_by_pid = 1;
 
-    if (options->only_name) {
-      if (options->show_cmdline) {  /* show_cmdline is on */
-        get_cmdline(pid, cmdline, sizeof(cmdline));
-        if (strstr(cmdline, options->only_name) == NULL) {
-          skip_by_pid = 1;
-        }
-      }
-      else {  /* show_cmdline is off */
-        if (strstr(proc_name, options->only_name) == NULL)
-          skip_by_pid = 1;
-      }
-    }
+/* Number of files opened by attach_counters for the task: one per
+   counter, PAPI events aside. */
+static int counter_files(const struct process_list* const list,
+                         const struct process* const p)
+{
+  int zz, n = 0;
+
+  for(zz = 0; zz < p->num_events; zz++) {
+    if (list->columns.papi[zz] == -1)
+      n++;
+  }
+  return n;
+}
 
-    /* my process, or somebody else's process and I am root (skip
-       root's processes because they are too many). */
-    skip_by_user = 1;
-    my_uid = options->euid;
-    if (((my_uid != 0) && (uid == my_uid)) ||  /* not root, monitor mine */
-        ((my_uid == 0) && (uid != 0)))         /* I am root, monitor all others */
-      skip_by_user = 0;
 
-    if ((skip_by_user == 0) && (skip_by_pid == 0)) {
-      DIR* thr_dir;
-      struct dirent* thr_dirent;
-      int  tid;
-      char task_name[50] = { 0 };
+/* Attach the counters of the screen to the task. Counters are opened
+   as a group, the first one being the leader: they are scheduled
+   together, and all read with a single syscall. PAPI events get an
+   eventset of their own, started here. Return 0 when the files limit
+   does not leave room for them: the task is then left without
+   counters, until balance_counters finds some room. */
+static int attach_counters(struct process_list* const list,
+                           const screen_t* const screen,
+                           struct STRUCT_NAME* events,
+                           struct process* const p)
+{
+  struct counter_columns* const c = &list->columns;
+  int zz;
 
-      snprintf(task_name, sizeof(task_name) - 1, "/proc/%d/task", pid);
-      thr_dir = opendir(task_name);
-      if (!thr_dir)  /* died just now? Will be marked dead at next iteration. */
-        continue;
+  const int cpu = -1;
+  const int grp = -1;
+  const int flags = 0;
+
+  if (num_files + counter_files(list, p) > num_files_limit) {
+    if (!limit_reported) {
+      error_printf("Files limit reached: counters are only attached to "
+                   "the most active tasks\n");
+      limit_reported = 1;
+    }
+    p->detached = 1;
+    return 0;
+  }
+
+  if (list->group_reads)
+    events->read_format = READ_FORMAT | GROUP_READ_FORMAT;
+  else
+    events->read_format = READ_FORMAT;
+
+  p->detached = 0;
+  p->last_active = time(NULL);
+  p->group_leader = -1;
+  if (list->num_papi) {
+    p->papi_eventset = get_eventset(list);
+    if (p->papi_eventset != PAPI_NULL) {
+      int retval = PAPI_attach(p->papi_eventset, p->tid);
+      if (retval == PAPI_OK)
+        retval = PAPI_start(p->papi_eventset);
+      if (retval != PAPI_OK) {
+        handle_error(retval);
+        put_eventset(list, p);
+      }
+    }
+  }
+  for(zz = 0; zz < p->num_events; zz++) {
+    int fd;
+
+    /* start from scratch, the task may have been detached */
+    c->values[zz][p->slot] = 0;
+    c->prev_values[zz][p->slot] = 0;
+    c->scaled[zz][p->slot] = 0;
+    c->raw[zz][p->slot] = 0;
+    c->enabled[zz][p->slot] = 0;
+    c->running[zz][p->slot] = 0;
+    if (c->papi[zz] != -1)  /* handled by PAPI */
+      continue;
 
-      /* Iterate over all threads in the process */
-      while ((thr_dirent = readdir(thr_dir))) {
-        int   zz, fail;
-        struct process* ptr;
-        struct passwd*  passwd;
+    events->type = screen->counters[zz].type;  /* eg PERF_TYPE_HARDWARE */
+    events->config = screen->counters[zz].config;
+
+    fd = open_counter(list, p, events, zz, cpu, grp, flags);
+    if (fd == -1)
+      error_printf("Could not attach counter '%s' to PID %d (%s): %s\n",
+                   screen->counters[zz].alias, p->tid, p->name,
+                   strerror(errno));
+    else
+      num_files++;
+    c->fd[zz][p->slot] = fd;
+  }
+  return 1;
+}
 
-        tid = atoi(thr_dirent->d_name);
-        if (tid == 0)
-          continue;
 
-        ptr = hash_get(tid);
-        if (ptr)  /* already known */
-          continue;
+/* Give the counters of the task back, to make room for a more active
+   one. Its counters show as invalid until it gets them again. */
+static void detach_counters(struct process_list* const list,
+                            struct process* const p)
+{
+  if (p->papi_eventset != PAPI_NULL)
+    put_eventset(list, p);
+  close_counters(list, p);
+  p->detached = 1;
+}
 
 
-        /* We have a new thread. */
+/* Create the entry for a newly discovered thread 'tid' of process
+   'pid', insert it in the list and attach the counters of the screen
+   (right away if 'attach' is set). */
+static void add_task(struct process_list* const list,
+                     const screen_t* const screen,
+                     const struct option* const options,
+                     struct STRUCT_NAME* events,
+                     pid_t tid, pid_t pid, uid_t uid, int num_threads,
+                     const char* proc_name, const char* cmdline, int attach)
+{
+  struct process* ptr;
+
+  ptr = new_record(list, tid, pid, uid, num_threads, screen->num_counters,
+                   proc_name, cmdline);
+  hash_add(tid, ptr);
+
+  /* keep the stat file open, it is read at each refresh */
+  if (num_files < num_files_limit) {
+    char stat_name[100] = { 0 };
+    stat_file_name(list, ptr, stat_name, sizeof(stat_name));
+    ptr->stat_fd = open(stat_name, O_RDONLY | O_CLOEXEC);
+    if (ptr->stat_fd != -1)
+      num_files++;
+  }
 
-        /* allocate memory */
-        ptr = malloc(sizeof(struct process));
+  /* The command run by tiptop is waited for when it is a zombie, see
+     update_proc_list. */
+  if ((tid == pid) && (list->exit_fd != -1) &&
+      (num_files < num_files_limit) && !is_spawned(tid))
+    watch_exit(list, ptr);
+
+  /* Counters are attached once the task is active (see
+     balance_counters), except when idle tasks are displayed, for the
+     command run by tiptop, monitored from its first instruction, and
+     when the caller asks for them. */
+  if (attach || options->idle || is_spawned(tid))
+    attach_counters(list, screen, events, ptr);
+  else
+    ptr->detached = 1;
+}
 
-        /* insert into list of processes */
-        ptr->next = list->processes;
-        list->processes = ptr;
 
-        /* update helper data structures */
-        if (num_tids == list->num_alloc) {
-          list->num_alloc += 20;
-          list->proc_ptrs = realloc(list->proc_ptrs,
-                                    list->num_alloc*sizeof(struct process));
-        }
-        list->proc_ptrs[num_tids] = ptr;
-        hash_add(tid, ptr);
-
-        /* fill in information for new process */
-        ptr->tid = tid;
-        ptr->pid = pid;
-        ptr->proc_id = -1;
-        ptr->dead = 0;
-#if 0
-        ptr->attention = 0;
-#endif
-        ptr->u.d = 0.0;
-
-        passwd = getpwuid(uid);
-        if (passwd)
-          ptr->username = strdup(passwd->pw_name);
-        else
-          ptr->username = NULL;
-
-        ptr->num_threads = (short)num_threads;
-        if (cmdline[0] == '\0')
-          get_cmdline(pid, cmdline, sizeof(cmdline));
-        ptr->cmdline = strdup(cmdline);
-        ptr->name = strdup(proc_name);
-        ptr->timestamp.tv_sec = 0;
-        ptr->timestamp.tv_usec = 0;
-        ptr->prev_cpu_time_s = 0;
-        ptr->prev_cpu_time_u = 0;
-        ptr->cpu_percent = 0.0;
-        ptr->cpu_percent_s = 0.0;
-        ptr->cpu_percent_u = 0.0;
-
-        /* Get number of counters from screen */
-        ptr->num_events = screen->num_counters;
-
-        for(zz = 0; zz < ptr->num_events; zz++)
-          ptr->prev_values[zz] = 0;
-
-        ptr->txt = malloc(TXT_LEN * sizeof(char));
-
-
-        int retval,EventSet = PAPI_NULL;
-
-        retval = PAPI_create_eventset(&EventSet);
-        if (retval != PAPI_OK) handle_error(retval);
-
-        retval = PAPI_assign_eventset_component(EventSet, 0);
-        if (retval != PAPI_OK) handle_error(retval);
-
-        retval = PAPI_set_multiplex(EventSet);
-        if (retval != PAPI_OK) handle_error(retval);
-
-        for(zz = 0; zz < MAX_EVENTS; zz++)
-            ptr->papi[zz] = -1;
-        
-        fail = 0;
-        for(zz = 0; zz < ptr->num_events; zz++) {
-          int fd;
-          events.type = screen->counters[zz].type;  /* eg PERF_TYPE_HARDWARE */
-          events.config = screen->counters[zz].config;
-
-            int EventCode = PAPI_NULL;
-            if (PAPI_event_name_to_code(screen->counters[zz].alias,&EventCode) == PAPI_OK) {
-                retval = PAPI_add_event(EventSet, EventCode);
-                if (retval != PAPI_OK) handle_error(retval);
-                ptr->papi[zz] = EventCode;
-            } else {
-                if (num_files < num_files_limit) {
-                    fd = sys_perf_counter_open(&events, tid, cpu, grp, flags);
-                    if (fd == -1) {
-                    error_printf("Could not attach counter '%s' to PID %d (%s): %s\n",
-                                screen->counters[zz].alias,
-                                tid,
-                                ptr->name,
-                                strerror(errno));
-                    }
-                } else {
-                    fd = -1;
-                    error_printf("Files limit reached for PID %d (%s)\n",
-                                tid, ptr->name);
-                }
-          }
-          
-
-          if (fd == -1)
-            fail++;
-          else
-            num_files++;
-          ptr->fd[zz] = fd;
-          ptr->values[zz] = 0;
-        }
+/* Create the row of cgroup 'cg', and open the counters of the screen
+   on every CPU for this cgroup. */
+static void add_cgroup(struct process_list* const list,
+                       const screen_t* const screen,
+                       struct STRUCT_NAME* events,
+                       const struct cgroup_entry* const cg)
+{
+  int   zz, cpu, dir_fd;
+  struct process* ptr;
 
-        if (PAPI_num_events(EventSet)>0) {
-            ptr->papi_eventset = EventSet;
-            
-            retval = PAPI_attach(EventSet, tid);
-            if (retval != PAPI_OK) handle_error(retval);
-        
-            retval = PAPI_start(EventSet);
-            if (retval != PAPI_OK) handle_error(retval);
-        } else {
-            ptr->papi_eventset = -1;
-            PAPI_cleanup_eventset(EventSet);
-            PAPI_destroy_eventset(&EventSet);
-        }
+  const int grp = -1;
 
-#if 0
-        if (fail) {
-          /* at least one counter failed, mark it */
-          ptr->attention = 1;
-        }
+  /* the path serves as name and command line */
+  ptr = new_record(list, (pid_t)cg->ino, (pid_t)cg->ino, cg->uid, 0,
+                   screen->num_counters, cg->path, cg->path);
+  ptr->ino = cg->ino;
+  if (hash_get(ptr->tid))  /* same key, another cgroup: see find_cgroup */
+    list->cgroup_collisions++;
+  else
+    hash_add(ptr->tid, ptr);
+
+  /* cpu.stat gives the %CPU, and tells when the cgroup is removed */
+  if (num_files < num_files_limit) {
+    ptr->stat_fd = cgroup_open(cg->path, "cpu.stat", O_RDONLY);
+    if (ptr->stat_fd != -1)
+      num_files++;
+  }
+
+  dir_fd = cgroup_open(cg->path, NULL, O_RDONLY | O_DIRECTORY);
+  if (dir_fd == -1)  /* removed just now */
+    return;
 
-        if (fail != ptr->num_events) {
-          /* at least one counter succeeded, insert the thread in list */
-          list->num_tids++;
-          num_tids++;
+  events->read_format = READ_FORMAT;
+  ptr->cpu_fd = malloc(ptr->num_events * num_cpus * sizeof(int));
+  for(zz = 0; zz < ptr->num_events; zz++) {
+    int opened = 0;
+
+    events->type = screen->counters[zz].type;
+    events->config = screen->counters[zz].config;
+
+    for(cpu = 0; cpu < num_cpus; cpu++) {
+      int fd = -1;
+      if (num_files < num_files_limit) {
+        /* fails on offline CPUs, the others are enough */
+        fd = sys_perf_counter_open(events, dir_fd, cpu, grp,
+                                   PERF_FLAG_PID_CGROUP);
+        if (fd != -1) {
+          num_files++;
+          opened++;
         }
-#endif
-        list->num_tids++;  /* insert in any case */
-        num_tids++;
       }
-      closedir(thr_dir);
+      ptr->cpu_fd[zz * num_cpus + cpu] = fd;
+    }
+
+    if (opened == 0) {
+      if (num_files < num_files_limit)
+        error_printf("Could not attach counter '%s' to cgroup %s: %s\n",
+                     screen->counters[zz].alias, cg->path, strerror(errno));
+      else
+        error_printf("Files limit reached for cgroup %s\n", cg->path);
     }
   }
-  closedir(pid_dir);
+  close(dir_fd);
 }
 
 
-/*
- * Update all processes in the list with newly collected statistics.
- * Return the number of dead processes.
- */
-int update_proc_list(struct process_list* const list,
-                     const screen_t* const screen,
-                     struct option* const options)
+static int cmp_pid_info(const void* p1, const void* p2)
 {
-  struct process* proc;
-  int    num_dead = 0;
-
-  assert(screen);
-  assert(list && list->proc_ptrs);
+  const struct pid_info* i1 = p1;
+  const struct pid_info* i2 = p2;
+  return (i1->pid > i2->pid) - (i1->pid < i2->pid);
+}
 
-  /* add newly created processes/threads */
-  new_processes(list, screen, options);
 
-  /* update statistics */
-  for(proc = list->processes; proc; proc = proc->next) {
-    FILE*     fstat;
-    char      sub_task_name[100] = { 0 };
-    double    elapsed;
-    unsigned long   utime = 0, stime = 0;
-    unsigned long   prev_cpu_time, curr_cpu_time;
-    int             proc_id, zz, zombie;
-    struct timeval  now;
-
-    if (proc->dead) {
-      num_dead++;
-      continue;
-    }
+/* Find the cached information for 'pid'. Only the sorted part of the
+   array is searched: PIDs appended by the scan in progress are new. */
+static struct pid_info* find_pid_info(const struct process_list* const list,
+                                      pid_t pid)
+{
+  struct pid_info key;
 
-    /* Compute %CPU, retrieve processor ID. */
-    snprintf(sub_task_name, sizeof(sub_task_name) - 1,
-             "/proc/%d/task/%d/stat", proc->pid, proc->tid);
-    fstat = fopen(sub_task_name, "r");
+  if (list->num_sorted_pids == 0)  /* no scan yet, the array may be NULL */
+    return NULL;
+  key.pid = pid;
+  return bsearch(&key, list->pids, list->num_sorted_pids,
+                 sizeof(struct pid_info), cmp_pid_info);
+}
 
-    if (!fstat) {  /* this task disappeared */
-      num_dead++;
-      proc->dead = 1;  /* mark dead */
-      for(zz=0; zz < proc->num_events; ++zz) {
-        if (proc->fd[zz] != -1) {
-          close(proc->fd[zz]);
-          num_files--;
-          proc->fd[zz] = -1;
-        }
-      }
-      continue;
-    }
 
-    zombie = 0;
-    if (fstat) {
-      int n;
-      char state;
-      n = fscanf(fstat,
-           "%*d (%*[^)]) %c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu",
-           &state, &utime, &stime);
-      if (n != 3)
-        utime = stime = 0;
-
-      if (state == 'Z') {  /* zombie */
-        zombie = 1;
-      }
+/* Append a blank entry for a PID seen for the first time. */
+static struct pid_info* new_pid_info(struct process_list* const list,
+                                     pid_t pid)
+{
+  struct pid_info* info;
 
-      /* get processor ID */
-
-
-      n = fscanf(fstat,
-                 "%*d %*d %*d %*d %*d %*d %*d %*u %*d %*u %*u %*u %*u "
-                 "%*u %*u %*u %*u %*u %*u %*u %*u %*u %*d %d",
-                 &proc_id);
-      if (n != 1)
-        proc_id = -1;
-      fclose(fstat);
-    }
-    if (!zombie) {
-      /* do not update these values for a zombie, they have become invalid */
-      gettimeofday(&now, NULL);
-      elapsed = (now.tv_sec - proc->timestamp.tv_sec) +
-        (now.tv_usec - proc->timestamp.tv_usec)/1000000.0;
-      elapsed *= clk_tck;
-
-      proc->timestamp = now;
-
-      prev_cpu_time = proc->prev_cpu_time_s + proc->prev_cpu_time_u;
-      curr_cpu_time = stime + utime;
-      proc->cpu_percent = 100.0*(curr_cpu_time - prev_cpu_time)/elapsed;
-      proc->cpu_percent_s = 100.0*(stime - proc->prev_cpu_time_s)/elapsed;
-      proc->cpu_percent_u = 100.0*(utime - proc->prev_cpu_time_u)/elapsed;
-
-      proc->prev_cpu_time_s = stime;
-      proc->prev_cpu_time_u = utime;
-    }
-
-    proc->proc_id = (short)proc_id;
-    /* Backup previous value of counters */
-    for(zz = 0; zz < proc->num_events; zz++)
-      proc->prev_values[zz] = proc->values[zz];
-
-    /* Read performance counters */
-    for(zz = 0; zz < proc->num_events; zz++) {
-      uint64_t value = 0;
-      int r;
-      /* When fd is -1, the syscall failed on that counter */
-      if (proc->fd[zz] != -1) {
-        r = read(proc->fd[zz], &value, sizeof(value));
-        if (r == sizeof(value))
-          proc->values[zz] = value;
-        else
-          proc->values[zz] = 0;
-      }
-      else  /* no fd, use marker */
-        proc->values[zz] = 0xffffffff;
-    }
-    if (zombie) {
-      proc->dead = 1;
-      wait_for_child(proc->tid, options);
-    }
+  if (list->num_pids == list->num_alloc_pids) {
+    list->num_alloc_pids = list->num_alloc_pids ? 2*list->num_alloc_pids : 256;
+    list->pids = realloc(list->pids,
+                         list->num_alloc_pids * sizeof(struct pid_info));
   }
-
-  return num_dead;
+  info = &list->pids[list->num_pids++];
+  info->pid = pid;
+  info->num_threads = -1;
+  info->tracked = 0;
+  info->name[0] = '\0';
+  return info;
 }
 
 
-/* Scan list of processes and deallocates the dead ones, compacting the list. */
-void compact_proc_list(struct process_list* const list)
+/* Drop the PIDs that were not seen by the last scan, and sort. */
+static void prune_pid_info(struct process_list* const list)
 {
-  struct process* p;
+  int i, n = 0;
+
+  for(i=0; i < list->num_pids; i++) {
+    if (list->pids[i].generation == list->scan_generation)
+      list->pids[n++] = list->pids[i];
+  }
+  list->num_pids = n;
+  qsort(list->pids, n, sizeof(struct pid_info), cmp_pid_info);
+  list->num_sorted_pids = n;
+}
+
+
+/* Start time of task 'tid' (clock ticks after boot), 0 if gone. */
+static unsigned long long task_starttime(pid_t pid, pid_t tid)
+{
+  char name[50] = { 0 };
+  char buf[STAT_BUF_LEN];
+  struct task_stat st;
+  int  fd, n;
+
+  snprintf(name, sizeof(name) - 1, "/proc/%d/task/%d/stat", pid, tid);
+  fd = open(name, O_RDONLY);
+  if (fd == -1)
+    return 0;
+  n = read(fd, buf, sizeof(buf) - 1);
+  close(fd);
+  if ((n <= 0) || (parse_task_stat(buf, n, &st) == -1))
+    return 0;
+  return st.starttime;
+}
+
+
+/* Does the record of 'tid' belong to another task than the one
+   running now under this tid? The start times tell. */
+static int tid_reused(pid_t pid, pid_t tid)
+{
+  const struct process* const p = hash_get(tid);
+  return p && !p->dead && p->starttime &&
+         (p->starttime != task_starttime(pid, tid));
+}
+
+
+/* Is 'tid', a thread of process 'pid', already in the list? The record
+   of a task can outlive it (dead, or not noticed yet) while its tid is
+   reused, typically on hosts with many short-lived tasks. Such a stale
+   record is retired and removed from the hash table, so that the new
+   task gets a fresh record. 'reused' tells that the PID was reused
+   since the last scan. */
+static int known_task(struct process_list* const list,
+                      pid_t tid, pid_t pid, int reused)
+{
+  struct process* const p = hash_get(tid);
+
+  if (!p)
+    return 0;
+  if (!p->dead && (p->pid == pid) && !reused)
+    return 1;
+
+  if (!p->dead)
+    retire_task(list, p);
+  hash_del(tid, p);
+  return 0;
+}
+
+
+/* Add the threads of process 'pid' that are not known yet. The
+   command line is only retrieved if needed (when empty). With
+   'attach', all the threads get their counters right away, the known
+   ones included. */
+static void add_threads(struct process_list* const list,
+                        const screen_t* const screen,
+                        const struct option* const options,
+                        struct STRUCT_NAME* events,
+                        pid_t pid, uid_t uid, int num_threads, int reused,
+                        int attach,
+                        const char* proc_name, char* cmdline, int size)
+{
+  DIR* thr_dir;
+  struct dirent* thr_dirent;
+  int  tid;
+  char task_name[50] = { 0 };
+
+  snprintf(task_name, sizeof(task_name) - 1, "/proc/%d/task", pid);
+  thr_dir = opendir(task_name);
+  if (!thr_dir)  /* died just now? Will be marked dead at next iteration. */
+    return;
+
+  /* Iterate over all threads in the process */
+  while ((thr_dirent = readdir(thr_dir))) {
+    tid = atoi(thr_dirent->d_name);
+    if (tid == 0)
+      continue;
+
+    if (known_task(list, tid, pid, reused)) {
+      struct process* const p = hash_get(tid);
+      if (attach && p->detached)
+        attach_counters(list, screen, events, p);
+      continue;
+    }
+
+    /* We have a new thread. */
+    if (cmdline[0] == '\0')
+      get_cmdline(pid, cmdline, size);
+    add_task(list, screen, options, events,
+             tid, pid, uid, num_threads, proc_name, cmdline, attach);
+  }
+  closedir(thr_dir);
+}
+
+
+/* Are the tasks of 'uid' left out? When I am root, root's processes
+   are (they are too many), otherwise only mine are monitored. */
+static int skip_user(const struct option* const options, uid_t uid)
+{
+  const uid_t my_uid = options->euid;
+  return !(((my_uid != 0) && (uid == my_uid)) ||  /* not root, monitor mine */
+           ((my_uid == 0) && (uid != 0)));        /* root, monitor all others */
+}
+
+
+/* Look at process 'pid' in /proc. If it qualifies (user, filters), add
+   all its threads that are not known yet. When 'info' is provided and
+   valid, the status file is not read again. 'reused' tells that the
+   PID belonged to another process at the last scan.
+
+   In per-process mode, the threads are only walked when the process
+   is seen for the first time: the threads that exist at that point
+   need their own counters (attached along with the ones of the
+   process, see balance_counters), the ones created later are counted
+   by inheritance. */
+static void scan_pid(struct process_list* const list,
+                     const screen_t* const screen,
+                     const struct option* const options,
+                     struct STRUCT_NAME* events,
+                     pid_t pid, struct pid_info* info, int reused)
+{
+  int   uid, num_threads, req_info;
+  char  name[50] = { 0 }; /* needs to fit /proc/xxxx/{status,cmdline} */
+  char  line[100]; /* line of /proc/xxxx/status */
+  char  proc_name[100];
+  int   skip_by_pid, skip_by_user;
+  char  cmdline[100];
+  FILE* f;
+
+  if (info && (info->num_threads != -1)) {
+    /* cached, only the set of threads changed */
+    uid = info->uid;
+    strcpy(proc_name, info->name);
+    num_threads = info->num_threads;
+  }
+  else {
+    snprintf(name, sizeof(name) - 1, "/proc/%d/status", pid);
+    f = fopen(name, "r");
+    if (!f)
+      return;
+
+    /* collect basic information about process */
+    req_info = 3;  /* need 3 pieces of information */
+    while (fgets(line, sizeof(line), f) && req_info) {
+      /* read the name now, since we will encounter it before Uid anyway */
+      if (strncmp(line, "Name:", 5) == 0) {
+        sscanf(line, "%*s %s", proc_name);
+        req_info--;
+      }
+      if (strncmp(line, "Uid:", 4) == 0) {
+        sscanf(line, "%*s %d", &uid);
+        req_info--;
+      }
+      if (strncmp(line, "Threads:", 8) == 0) {
+        sscanf(line, "%*s %d", &num_threads);
+        req_info--;
+      }
+    }
+    fclose(f);
+
+    if (req_info != 0) {  /* could not read all 3 info. Process is gone? */
+      error_printf("Could not read info for process %d (gone already?)\n", pid);
+      return;
+    }
+
+    if (info) {
+      info->uid = uid;
+      info->num_threads = num_threads;
+      strncpy(info->name, proc_name, sizeof(info->name) - 1);
+      info->name[sizeof(info->name) - 1] = '\0';
+    }
+  }
+
+  cmdline[0] = '\0';
+  skip_by_pid = 0;
+  /* if "only" filter is set */
+  if (options->only_pid && (pid != options->only_pid))
+    skip_by_pid = 1;
+
+  if (options->only_name) {
+    if (options->show_cmdline) {  /* show_cmdline is on */
+      get_cmdline(pid, cmdline, sizeof(cmdline));
+      if (strstr(cmdline, options->only_name) == NULL) {
+        skip_by_pid = 1;
+      }
+    }
+    else {  /* show_cmdline is off */
+      if (strstr(proc_name, options->only_name) == NULL)
+        skip_by_pid = 1;
+    }
+  }
+
+  skip_by_user = skip_user(options, uid);
+
+  if (info)
+    info->tracked = (skip_by_user == 0) && (skip_by_pid == 0);
+
+  if (list->per_process && known_task(list, pid, pid, reused))
+    return;  /* already attached */
+
+  if ((skip_by_user == 0) && (skip_by_pid == 0))
+    add_threads(list, screen, options, events, pid, uid, num_threads, reused,
+                0, proc_name, cmdline, sizeof(cmdline));
+}
+
+
+/* Was process 'pid' left out by the filters when last looked at? Its
+   new threads, and its children until they exec, have the same user
+   and name, hence are left out too (unless 'new_pid' is the PID
+   selected with -p). Unknown processes are not. */
+static int filtered_out(const struct process_list* const list,
+                        const struct option* const options,
+                        pid_t pid, pid_t new_pid)
+{
+  const struct pid_info* const info = find_pid_info(list, pid);
+
+  if (!info || (info->num_threads == -1))
+    return 0;
+  if (options->only_pid && (new_pid == options->only_pid))
+    return 0;
+  return !info->tracked;
+}
+
+
+/* Consume the notifications of the proc connector, and update the
+   list accordingly. Return 0 if notifications have been lost, in
+   which case a full scan of /proc is required. */
+static int drain_proc_events(struct process_list* const list,
+                             const screen_t* const screen,
+                             const struct option* const options,
+                             struct STRUCT_NAME* events)
+{
+  struct task_event ev;
+  struct pid_info* info;
+  int n;
+
+  while ((n = proc_events_next(list->events_fd, &ev)) > 0) {
+    struct process* owner;
+
+    switch (ev.type) {
+    case TASK_FORK:
+      /* A fork makes a new task: a known tid is the same task only if
+         the initial scan found it already. */
+      if (known_task(list, ev.tid, ev.pid, tid_reused(ev.pid, ev.tid)))
+        break;
+      /* New thread in a known process: reuse what we know about the
+         process, no need to look at /proc/PID. In per-process mode,
+         the counters of the process are inherited by the thread. The
+         process has one more thread than when last sampled. */
+      owner = hash_get(ev.pid);
+      if ((ev.tid != ev.pid) && owner && !owner->dead) {
+        if (!list->per_process)
+          add_task(list, screen, options, events,
+                   ev.tid, ev.pid, owner->uid, owner->num_threads + 1,
+                   owner->name, owner->cmdline, 0);
+      }
+      else if (!filtered_out(list, options,
+                             (ev.tid != ev.pid) ? ev.pid : ev.ppid, ev.pid))
+        scan_pid(list, screen, options, events, ev.pid, NULL, 0);
+      break;
+
+    case TASK_EXEC:
+      if (hash_get(ev.pid))
+        update_name_cmdline(ev.pid, 0);
+      else {  /* the new name may pass the filters, read the status again */
+        info = find_pid_info(list, ev.pid);
+        if (info)
+          info->num_threads = -1;
+        scan_pid(list, screen, options, events, ev.pid, info, 0);
+      }
+      break;
+
+    case TASK_EXIT:
+      /* Nothing to do: the pidfd of the process (release_exited) or
+         update_proc_list notice that the task is gone, as with the
+         /proc scan. The cached information about the process must not
+         apply to the next user of the PID. */
+      if ((ev.tid == ev.pid) && (info = find_pid_info(list, ev.pid))) {
+        info->num_threads = -1;
+        info->ino = 0;
+      }
+      break;
+    }
+  }
+  return (n == 0);
+}
+
+
+/* Row of the cgroup of inode 'ino', NULL if none. The hash key is the
+   inode cut to a pid_t: when two cgroups share a key, the second one
+   is only found in the list. */
+static struct process* find_cgroup(const struct process_list* const list,
+                                   ino_t ino)
+{
+  struct process* p = hash_get((pid_t)ino);
+
+  if (p && (p->ino == ino))
+    return p;
+  if (!list->cgroup_collisions)  /* all rows are in the hash table */
+    return NULL;
+  for(p = list->processes; p; p = p->next) {
+    if (!p->dead && (p->ino == ino))
+      return p;
+  }
+  return NULL;
+}
+
+
+/* Add the cgroups that appeared since the last scan. */
+static void new_cgroups(struct process_list* const list,
+                        const screen_t* const screen,
+                        const struct option* const options)
+{
+  struct STRUCT_NAME events = {0, };
+  int i, n;
+
+  init_events_attr(list, &events, options);
+
+  n = cgroup_scan(&list->cgroup_entries, &list->num_alloc_cgroups);
+  for(i=0; i < n; i++) {
+    const struct cgroup_entry* cg = &list->cgroup_entries[i];
+    if (!find_cgroup(list, cg->ino))
+      add_cgroup(list, screen, &events, cg);
+  }
+}
+
+
+void new_processes(struct process_list* const list,
+                   const screen_t* const screen,
+                   const struct option* const options)
+{
+  struct dirent* pid_dirent;
+  DIR*           pid_dir;
+  int            val, n;
+  struct STRUCT_NAME events = {0, };
+  FILE*          f;
+
+  users_check();
+
+  if (list->cgroups) {
+    new_cgroups(list, screen, options);
+    return;
+  }
+
+  init_events_attr(list, &events, options);
+
+  /* Subscribe to the proc connector the first time. The socket is
+     open before the initial scan, so that no task falls in between. */
+  if (options->netlink && (list->events_fd == -1) && !list->events_failed) {
+    list->events_fd = proc_events_open();
+    if (list->events_fd == -1) {
+      error_printf("Could not subscribe to process events (%s), "
+                   "scanning /proc instead\n", strerror(errno));
+      list->events_failed = 1;
+    }
+    else
+      list->events_rescan = 1;  /* initial scan */
+  }
+
+  if (list->events_fd != -1) {
+    /* Incremental update. If notifications were lost, rescan. */
+    if (!list->events_rescan && drain_proc_events(list, screen, options,
+                                                  &events))
+      return;
+    list->events_rescan = 0;
+  }
+  else {
+    /* To avoid scanning the entire /proc directory, we first check if
+       any process has been created since last time. /proc/loadavg
+       contains the PID of the most recent process. We compare with our
+       own most recent. */
+    f = fopen("/proc/loadavg", "r");
+    n = fscanf(f, "%*f %*f %*f %*d/%*d %d", &val);
+    fclose(f);
+    /* if no new process has been created since last time, just quit. */
+    if ((n == 1) && (val == list->most_recent_pid))
+      return;
+
+    list->most_recent_pid = val;
+  }
+
+  /* check all directories of /proc */
+  list->scan_generation++;
+  pid_dir = opendir("/proc");
+  while ((pid_dirent = readdir(pid_dir))) {
+    int pid, num_threads, reused = 0;
+    struct pid_info* info;
+    struct stat st;
+    char  task_name[50] = { 0 };
+
+    if (pid_dirent->d_type != DT_DIR)  /* not a directory */
+      continue;
+
+    if ((pid = atoi(pid_dirent->d_name)) == 0)  /* not a number */
+      continue;
+
+    /* The link count of /proc/PID/task is 2 + number of threads. A
+       single stat tells us whether anything changed since last time. */
+    snprintf(task_name, sizeof(task_name) - 1, "%d/task", pid);
+    if (fstatat(dirfd(pid_dir), task_name, &st, 0) == -1)
+      continue;  /* gone */
+    num_threads = st.st_nlink - 2;
+
+    info = find_pid_info(list, pid);
+    if (info && (info->ino == pid_dirent->d_ino) && (info->owner == st.st_uid)) {
+      info->generation = list->scan_generation;
+      if (info->tracked) {
+        if (info->num_threads == num_threads)
+          continue;  /* same threads as last time */
+        info->num_threads = num_threads;
+      }
+      else if (!options->only_name)
+        continue;  /* still filtered out */
+      else
+        info->num_threads = -1;  /* name may have changed with exec */
+    }
+    else {
+      /* new process, or the PID was reused (the inode may also change
+         for the same process, check) */
+      if (!info)
+        info = new_pid_info(list, pid);
+      else
+        reused = tid_reused(pid, pid);
+      info->ino = pid_dirent->d_ino;
+      info->owner = st.st_uid;
+      info->num_threads = -1;
+      info->tracked = 0;
+      info->generation = list->scan_generation;
+    }
+
+    scan_pid(list, screen, options, &events, pid, info, reused);
+  }
+  closedir(pid_dir);
+  prune_pid_info(list);
+}
+
+
+/* Record a new reading of counter 'zz'. When the counter was not
+   running during the whole period (multiplexing), the increment is
+   extrapolated to the time it was enabled. 'scaled' accumulates the
+   scaled increments. */
+static void scale_counter(struct counter_columns* const c,
+                          struct process* const p, int zz,
+                          uint64_t raw, uint64_t enabled, uint64_t running)
+{
+  uint64_t delta = raw - c->raw[zz][p->slot];
+  uint64_t d_enabled = enabled - c->enabled[zz][p->slot];
+  uint64_t d_running = running - c->running[zz][p->slot];
+  double   ratio = 1.0;
+
+  if (d_running < d_enabled) {
+    ratio = (double)d_running / d_enabled;
+    if (d_running)
+      delta = (uint64_t)(delta / ratio);
+    else  /* not scheduled at all, nothing to extrapolate from */
+      delta = 0;
+  }
+  if (ratio < p->mux_ratio)
+    p->mux_ratio = ratio;
+
+  c->scaled[zz][p->slot] += delta;
+  c->raw[zz][p->slot] = raw;
+  c->enabled[zz][p->slot] = enabled;
+  c->running[zz][p->slot] = running;
+}
+
+
+/* Store the counters of the task. 'buf' holds the read of the group
+   ('r' bytes, or -errno), independent counters are read here. PAPI
+   events are snapshotted here too, so that expressions only see plain
+   values. */
+static void store_counters(struct process_list* const list,
+                           struct process* const p,
+                           const uint64_t* buf, int r)
+{
+  struct counter_columns* const c = &list->columns;
+  long long papi_values[list->num_papi + 1];  /* never empty */
+  int      zz, i, nr = 0, pos = 0, papi_ok = 0;
+
+  p->mux_ratio = 1.0;
+
+  if (p->group_leader != -1) {
+    if (r >= (int)(3 * sizeof(uint64_t)))
+      nr = buf[0];
+    if (nr > (int)(r / sizeof(uint64_t) - 3) / 2)
+      nr = 0;  /* truncated, should not happen */
+  }
+
+  /* PAPI events: the whole eventset with a single call */
+  if (p->papi_eventset != PAPI_NULL)
+    papi_ok = (PAPI_read(p->papi_eventset, papi_values) == PAPI_OK);
+
+  for(zz = 0; zz < p->num_events; zz++) {
+    c->prev_values[zz][p->slot] = c->scaled[zz][p->slot];
+    if (c->papi[zz] != -1) {
+      if (papi_ok) {  /* counts since attached, already scaled */
+        c->scaled[zz][p->slot] = papi_values[c->papi[zz]];
+        c->values[zz][p->slot] = c->scaled[zz][p->slot];
+      }
+      else
+        c->values[zz][p->slot] = 0xffffffff;
+      continue;
+    }
+    if (c->fd[zz][p->slot] == -1) {  /* the syscall failed on that counter, marker */
+      c->values[zz][p->slot] = 0xffffffff;
+      continue;
+    }
+
+    if (p->group_leader == -1) {
+      uint64_t val[3];  /* value, time enabled, time running */
+      if (read(c->fd[zz][p->slot], val, sizeof(val)) != sizeof(val)) {
+        c->values[zz][p->slot] = 0xffffffff;  /* no fresh value */
+        continue;
+      }
+      scale_counter(c, p, zz, val[0], val[1], val[2]);
+    }
+    else {
+      /* Values come in the order the counters joined the group. Check
+         the ID (when known), in case a counter failed to join. */
+      i = pos;
+      if (c->ids[zz][p->slot] && ((i >= nr) || (buf[4 + 2*i] != c->ids[zz][p->slot]))) {
+        for(i = 0; (i < nr) && (buf[4 + 2*i] != c->ids[zz][p->slot]); i++)
+          ;
+      }
+      if (i >= nr) {  /* the read of the group failed, or not in it */
+        c->values[zz][p->slot] = 0xffffffff;
+        continue;
+      }
+      scale_counter(c, p, zz, buf[3 + 2*i], buf[1], buf[2]);
+      pos = i + 1;
+    }
+    c->values[zz][p->slot] = c->scaled[zz][p->slot];
+  }
+}
+
+
+/* Read the counters of the task: the whole group with a single
+   syscall, or each counter when they are independent. */
+static void read_counters(struct process_list* const list,
+                          struct process* const p)
+{
+  /* group: nr, time enabled, time running, then (value, id) pairs */
+  uint64_t buf[3 + 2*p->num_events];
+  int      r = 0;
+
+  if (p->group_leader != -1)
+    r = read(list->columns.fd[p->group_leader][p->slot], buf, sizeof(buf));
+  store_counters(list, p, buf, r);
+}
+
+
+/* The task did not run since the last refresh: its counters did not
+   change, no need to read them. */
+static void keep_counters(struct process_list* const list,
+                          struct process* const p)
+{
+  struct counter_columns* const c = &list->columns;
+  int zz;
+
+  for(zz = 0; zz < p->num_events; zz++) {
+    if (c->values[zz][p->slot] != 0xffffffff) {
+      c->prev_values[zz][p->slot] = c->scaled[zz][p->slot];
+      c->values[zz][p->slot] = c->scaled[zz][p->slot];
+    }
+  }
+}
+
+
+/* The task has no counters. If it is active, this shows as invalid
+   values (not measured). If it is idle, it counts as no events, so
+   that idle threads do not spoil the totals of their process. */
+static void no_counters(struct process_list* const list,
+                        struct process* const p, int active)
+{
+  struct counter_columns* const c = &list->columns;
+  int zz;
+
+  for(zz = 0; zz < p->num_events; zz++) {
+    c->prev_values[zz][p->slot] = 0;
+    c->values[zz][p->slot] = active ? 0xffffffff : 0;
+  }
+}
+
+
+/* Update the statistics of a cgroup: %CPU from cpu.stat (in 'buf'),
+   counters summed over all CPUs (and scaled as a whole). */
+static void update_cgroup(struct process_list* const list,
+                          struct process* const p, const char* buf)
+{
+  struct counter_columns* const c = &list->columns;
+  unsigned long long user, system;
+  struct timeval now;
+  double elapsed;
+  int    zz, cpu;
+
+  if (cgroup_parse_stat(buf, &user, &system) == 0) {
+    gettimeofday(&now, NULL);
+    elapsed = (now.tv_sec - p->timestamp.tv_sec) * 1000000.0 +
+      (now.tv_usec - p->timestamp.tv_usec);
+    p->timestamp = now;
+
+    /* times are in microseconds */
+    p->cpu_percent = 100.0*(user + system -
+                            p->prev_cpu_time_u - p->prev_cpu_time_s)/elapsed;
+    p->cpu_percent_s = 100.0*(system - p->prev_cpu_time_s)/elapsed;
+    p->cpu_percent_u = 100.0*(user - p->prev_cpu_time_u)/elapsed;
+    p->prev_cpu_time_s = system;
+    p->prev_cpu_time_u = user;
+  }
+
+  p->mux_ratio = 1.0;
+  for(zz = 0; zz < p->num_events; zz++) {
+    uint64_t sum[3] = { 0, 0, 0 };  /* value, time enabled, time running */
+    int      num_read = 0;
+
+    c->prev_values[zz][p->slot] = c->scaled[zz][p->slot];
+    for(cpu = 0; p->cpu_fd && (cpu < num_cpus); cpu++) {
+      uint64_t val[3];
+      int fd = p->cpu_fd[zz * num_cpus + cpu];
+      if ((fd != -1) && (read(fd, val, sizeof(val)) == sizeof(val))) {
+        sum[0] += val[0];
+        sum[1] += val[1];
+        sum[2] += val[2];
+        num_read++;
+      }
+    }
+    if (num_read) {
+      scale_counter(c, p, zz, sum[0], sum[1], sum[2]);
+      c->values[zz][p->slot] = c->scaled[zz][p->slot];
+    }
+    else  /* no handle at all, use marker */
+      c->values[zz][p->slot] = 0xffffffff;
+  }
+}
+
+
+/* Should counters be attached to the task? */
+static int wants_counters(const struct process* const p,
+                          const struct option* const options)
+{
+  return options->idle || (p->cpu_percent >= options->cpu_threshold);
+}
+
+
+/* Most active tasks first */
+static int cmp_cpu_avg(const void* p1, const void* p2)
+{
+  const struct process* const q1 = *(struct process* const*)p1;
+  const struct process* const q2 = *(struct process* const*)p2;
+  return (q1->cpu_avg < q2->cpu_avg) - (q1->cpu_avg > q2->cpu_avg);
+}
+
+
+/* Attach counters to the tasks that became active. If the files limit
+   is reached, take the counters of the least active tasks, when they
+   are less active. Only the counters are given back: the stat files
+   and pidfds stay with their tasks. */
+static void balance_counters(struct process_list* const list,
+                             const screen_t* const screen,
+                             const struct option* const options)
+{
+  struct process** tasks;
+  struct process*  p;
+  struct process*  top = NULL;     /* most active waiting task */
+  struct process*  bottom = NULL;  /* least active task with counters */
+  struct STRUCT_NAME events = {0, };
+  int    n = 0, first, last, need;
+
+  /* Most often, no room is left and the waiting tasks are not more
+     active than the ones with counters: nothing to do, and no need to
+     sort. */
+  for(p = list->processes; p; p = p->next) {
+    if (p->dead || p->summary)
+      continue;
+    if (!p->detached) {
+      if (!bottom || (p->cpu_avg < bottom->cpu_avg))
+        bottom = p;
+    }
+    else if (wants_counters(p, options) && (!top || (p->cpu_avg > top->cpu_avg)))
+      top = p;
+  }
+  if (!top)
+    return;
+  if ((num_files + counter_files(list, top) > num_files_limit) &&
+      (!bottom || (bottom->cpu_avg + EVICT_MARGIN > top->cpu_avg)))
+    return;
+
+  tasks = malloc(list->num_tids * sizeof(struct process*));
+  for(p = list->processes; p; p = p->next) {
+    if (!p->dead && !p->summary)
+      tasks[n++] = p;
+  }
+  qsort(tasks, n, sizeof(struct process*), cmp_cpu_avg);
+
+  init_events_attr(list, &events, options);
+
+  /* Walk from both ends: most active detached tasks, and least active
+     tasks with counters. */
+  last = n - 1;
+  for(first = 0; first < n; first++) {
+    struct process* const w = tasks[first];
+    if (!w->detached || !wants_counters(w, options))
+      continue;
+
+    need = counter_files(list, w);
+    while ((num_files + need > num_files_limit) && (last > first)) {
+      struct process* const v = tasks[last];
+      if (v->cpu_avg + EVICT_MARGIN > w->cpu_avg)
+        break;  /* nobody less active, done */
+      if (!v->detached)
+        detach_counters(list, v);
+      last--;
+    }
+    if (num_files + need > num_files_limit)
+      break;
+    attach_counters(list, screen, &events, w);
+
+    /* Per-process mode: the threads created before the counters were
+       attached do not inherit them, they get their own now. */
+    if (list->per_process && (w->pid == w->tid)) {
+      char cmdline[100];
+      strncpy(cmdline, w->cmdline, sizeof(cmdline) - 1);
+      cmdline[sizeof(cmdline) - 1] = '\0';
+      add_threads(list, screen, options, &events, w->pid, w->uid,
+                  w->num_threads, 0, 1, w->name, cmdline, sizeof(cmdline));
+    }
+  }
+  free(tasks);
+}
+
+
+/* Outcome of the sampling of a task, see sample_task. With --uring,
+   SAMPLE_COUNTERS is added when the read of the group is batched.
+   Summaries of exited tasks are not sampled (SAMPLE_SUMMARY). */
+enum { SAMPLE_SKIP, SAMPLE_OK, SAMPLE_GONE, SAMPLE_ZOMBIE, SAMPLE_SUMMARY };
+#define SAMPLE_COUNTERS 0x10
+
+/* One refresh worth of sampling, shared by the workers */
+struct sample_job {
+  struct process_list* list;
+  const struct option* options;
+  char*                outcomes;  /* per task of proc_ptrs */
+};
+
+
+/* I/O area of task 'i' of proc_ptrs (--uring): its stat file, then
+   the read of its group. */
+static char* io_area(const struct process_list* const list, int i)
+{
+  return list->io_buf + (size_t)i * list->io_stride;
+}
+
+
+/* Make room for the reads of 'num' tasks. The area is registered with
+   the ring, when the memory lock limit allows. */
+static void grow_io(struct process_list* const list, int num)
+{
+  char* old = list->io_buf;
+
+  if (num <= list->num_alloc_io)
+    return;
+  while (list->num_alloc_io < num)
+    list->num_alloc_io = list->num_alloc_io ? 2 * list->num_alloc_io : 256;
+  list->io_buf = malloc((size_t)list->num_alloc_io * list->io_stride);
+  list->io_res = realloc(list->io_res, 2 * list->num_alloc_io * sizeof(int));
+  uring_register_buffer(list->ring, list->io_buf,
+                        (size_t)list->num_alloc_io * list->io_stride);
+  free(old);
+}
+
+
+/* Wait for the reads submitted to the ring. If the ring failed, it is
+   closed, and the files are read one by one from then on. Its results
+   are no longer collected, and the I/O area is kept until
+   done_proc_list, in case the kernel still writes to it. */
+static void wait_reads(struct process_list* const list)
+{
+  if (uring_wait(list->ring) == -1) {
+    error_printf("io_uring failed, reading files one by one\n");
+    uring_close(list->ring);
+    list->ring = NULL;
+  }
+}
+
+
+/* Read the stat files of the tasks that have a handle, all at once.
+   The others are read by sample_task. */
+static void batch_stat_reads(struct process_list* const list)
+{
+  int i;
+
+  grow_io(list, list->num_tids);
+  for(i = 0; i < list->num_tids; i++) {
+    const struct process* const p = list->proc_ptrs[i];
+    if (!p->dead && (p->stat_fd != -1))
+      uring_read(list->ring, p->stat_fd, io_area(list, i), STAT_BUF_LEN - 1,
+                 &list->io_res[2*i]);
+    else
+      list->io_res[2*i] = URING_PENDING;
+  }
+  wait_reads(list);
+}
+
+
+/* Read the groups of counters that sample_task left, all at once.
+   Return the number of reads. */
+static int batch_counter_reads(struct process_list* const list,
+                               const char* const outcomes)
+{
+  struct counter_columns* const c = &list->columns;
+  int i, num = 0;
+
+  for(i = 0; i < list->num_tids; i++) {
+    const struct process* const p = list->proc_ptrs[i];
+    if (!(outcomes[i] & SAMPLE_COUNTERS))
+      continue;
+    uring_read(list->ring, c->fd[p->group_leader][p->slot],
+               io_area(list, i) + STAT_BUF_LEN,
+               (3 + 2*p->num_events) * sizeof(uint64_t), &list->io_res[2*i+1]);
+    num++;
+  }
+  wait_reads(list);
+  return num;
+}
+
+static char* outcomes = NULL;
+static int   num_alloc_outcomes = 0;
+
+
+/* Collect the statistics of the task: %CPU, processor, counters. Only
+   the task itself (its record and its slot in the counter columns) is
+   written, so that tasks can be sampled in parallel. What affects the
+   list (dead tasks, file handles) is left to the caller, according to
+   the returned outcome. With --uring, 'io' is the I/O area of the
+   task, where the stat file was read ('stat_res' bytes, or -errno);
+   otherwise 'io' is NULL and 'stat_res' URING_PENDING. */
+static int sample_task(struct process_list* const list,
+                       const struct option* const options,
+                       struct process* const proc,
+                       char* io, int stat_res)
+{
+  char      local_buf[STAT_BUF_LEN];
+  char*     stat_buf = io ? io : local_buf;
+  int       stat_len;
+  struct task_stat st;
+  double    elapsed;
+  unsigned long   utime = 0, stime = 0;
+  unsigned long   prev_cpu_time, curr_cpu_time;
+  int             proc_id, zombie, ran = 0;
+  struct timeval  now;
+
+  /* Compute %CPU, retrieve processor ID. */
+  if (stat_res == URING_PENDING)  /* not batched */
+    stat_len = read_task_stat(list, proc, stat_buf, STAT_BUF_LEN);
+  else if ((stat_res == 0) || (stat_res == -ESRCH) || (stat_res == -ENOENT))
+    stat_len = -1;
+  else if (stat_res < 0)  /* the batched read failed, not the task */
+    stat_len = read_task_stat(list, proc, stat_buf, STAT_BUF_LEN);
+  else {
+    stat_len = stat_res;
+    stat_buf[stat_len] = '\0';
+  }
+  if (stat_len == -1)  /* this task disappeared */
+    return SAMPLE_GONE;
+
+  if (list->cgroups) {
+    update_cgroup(list, proc, stat_buf);
+    return SAMPLE_OK;
+  }
+
+  zombie = 0;
+  if (parse_task_stat(stat_buf, stat_len, &st) == 0) {
+    /* Same tid, another task: the file was opened by name (files
+       limit) after the tid was reused. The new task is added by the
+       next scan. */
+    if (proc->starttime && (st.starttime != proc->starttime))
+      return SAMPLE_GONE;
+    proc->starttime = st.starttime;
+    proc->ppid = st.ppid;
+
+    utime = st.utime;
+    stime = st.stime;
+    proc_id = st.processor;
+    if (st.num_threads > 0)
+      proc->num_threads = (short)st.num_threads;
+
+    if (st.state == 'Z') {  /* zombie */
+      zombie = 1;
+    }
+  }
+  else
+    proc_id = -1;
+  if (!zombie) {
+    /* do not update these values for a zombie, they have become invalid */
+    gettimeofday(&now, NULL);
+    elapsed = (now.tv_sec - proc->timestamp.tv_sec) +
+      (now.tv_usec - proc->timestamp.tv_usec)/1000000.0;
+    elapsed *= clk_tck;
+
+    proc->timestamp = now;
+
+    prev_cpu_time = proc->prev_cpu_time_s + proc->prev_cpu_time_u;
+    curr_cpu_time = stime + utime;
+    proc->cpu_percent = 100.0*(curr_cpu_time - prev_cpu_time)/elapsed;
+    proc->cpu_percent_s = 100.0*(stime - proc->prev_cpu_time_s)/elapsed;
+    proc->cpu_percent_u = 100.0*(utime - proc->prev_cpu_time_u)/elapsed;
+
+    proc->prev_cpu_time_s = stime;
+    proc->prev_cpu_time_u = utime;
+    proc->cpu_avg = (proc->cpu_avg + proc->cpu_percent) / 2;
+
+    ran = (curr_cpu_time != prev_cpu_time);
+    if (ran)
+      proc->last_active = now.tv_sec;
+  }
+
+  proc->proc_id = (short)proc_id;
+
+  /* Read performance counters, unless the task did not run */
+  if (proc->detached)
+    no_counters(list, proc, proc->cpu_percent >= options->cpu_threshold);
+  else if (!ran && !zombie)
+    keep_counters(list, proc);
+  else if (io && (proc->group_leader != -1))
+    return (zombie ? SAMPLE_ZOMBIE : SAMPLE_OK) | SAMPLE_COUNTERS;
+  else
+    read_counters(list, proc);
+
+  return zombie ? SAMPLE_ZOMBIE : SAMPLE_OK;
+}
+
+
+static void sample_one(void* arg, int i)
+{
+  const struct sample_job* const job = arg;
+  struct process_list* const list = job->list;
+  struct process* const p = list->proc_ptrs[i];
+
+  if (p->dead)
+    job->outcomes[i] = SAMPLE_SKIP;
+  else if (p->summary)
+    job->outcomes[i] = SAMPLE_SUMMARY;
+  else if (list->ring)
+    job->outcomes[i] = sample_task(list, job->options, p, io_area(list, i),
+                                   list->io_res[2*i]);
+  else
+    job->outcomes[i] = sample_task(list, job->options, p, NULL,
+                                   URING_PENDING);
+}
+
+
+/* Store the counters read by batch_counter_reads. */
+static void finish_one(void* arg, int i)
+{
+  const struct sample_job* const job = arg;
+  struct process_list* const list = job->list;
+  struct process* const p = list->proc_ptrs[i];
+  const int r = list->io_res[2*i+1];
+
+  if (!(job->outcomes[i] & SAMPLE_COUNTERS))
+    return;
+  job->outcomes[i] &= ~SAMPLE_COUNTERS;
+  if (r == URING_PENDING)  /* the ring failed */
+    read_counters(list, p);
+  else
+    store_counters(list, p, (const uint64_t*)(io_area(list, i) + STAT_BUF_LEN),
+                   r);
+}
+
+
+/* Fold the exit record of a task into the summaries. For a task in
+   the list, only the CPU time since its last sample is missing. The
+   others (never seen, or threads of a process in the list) count in
+   full, if they pass the filters. In per-process mode, the threads
+   are already counted in the stat file of their process: only the
+   tail of single-threaded processes is accounted. */
+static void fold_exit(struct process_list* const list,
+                      const struct option* const options,
+                      const struct task_exit* const ex)
+{
+  const pid_t pid = ex->pid ? ex->pid : ex->tid;  /* unknown: no thread */
+  unsigned long long utime = ex->utime;
+  unsigned long long stime = ex->stime;
+  unsigned long long prev;
+  struct exit_summary* s;
+  struct process* p = hash_get(ex->tid);
+  struct process* owner;
+
+  if (p && (p->pid == pid)) {
+    if (list->per_process && ((p->tid != p->pid) || (p->num_threads > 1)))
+      return;
+    /* clock ticks to microseconds */
+    prev = p->prev_cpu_time_u * 1000000ULL / clk_tck;
+    utime = (utime > prev) ? utime - prev : 0;
+    prev = p->prev_cpu_time_s * 1000000ULL / clk_tck;
+    stime = (stime > prev) ? stime - prev : 0;
+    s = find_summary(list, p->ppid ? p->ppid : ex->ppid, p->uid, p->name);
+  }
+  else {
+    owner = hash_get(pid);
+    if (owner && (owner->pid == pid)) {
+      if (list->per_process)
+        return;
+    }
+    else if (skip_user(options, ex->uid) ||
+             (options->only_pid && (pid != options->only_pid)) ||
+             (options->only_name && !strstr(ex->name, options->only_name)))
+      return;
+    s = find_summary(list, ex->ppid, ex->uid, ex->name);
+  }
+  s->utime += utime;
+  s->stime += stime;
+  s->num_exits++;
+}
+
+
+/* Consume the exit records received so far (--exits). */
+static void drain_exits(struct process_list* const list,
+                        const struct option* const options)
+{
+  struct task_exit ex;
+  int n;
+
+  if (list->taskstats_fd == -1)
+    return;
+  while ((n = taskstats_next(list->taskstats_fd, &ex)) != 0) {
+    if (n == 1)
+      fold_exit(list, options, &ex);
+    /* else records were lost, nothing to do about it */
+  }
+}
+
+
+/* Update the rows of the summaries with what was folded since the
+   last refresh: %CPU over the interval, and the increments of the
+   counters (not measured when no task had counters). The summaries
+   without exits are removed. Return the number of rows removed. */
+static int publish_summaries(struct process_list* const list,
+                             const screen_t* const screen)
+{
+  struct counter_columns* const c = &list->columns;
+  struct timeval now;
+  double elapsed;
+  int    i, zz, num_dead = 0;
+
+  gettimeofday(&now, NULL);
+  elapsed = (now.tv_sec - list->last_fold.tv_sec) * 1000000.0 +
+    (now.tv_usec - list->last_fold.tv_usec);
+  list->last_fold = now;
+
+  i = 0;
+  while (i < list->num_summaries) {
+    struct exit_summary* const s = &list->summaries[i];
+    struct process* p = s->row;
+
+    if (!s->num_exits && !s->measured) {
+      if (p) {
+        p->dead = 1;
+        num_dead++;
+      }
+      str_release(s->name);
+      free(s->sums);
+      list->summaries[i] = list->summaries[--list->num_summaries];
+      continue;
+    }
+
+    if (!p) {
+      p = new_record(list, s->ppid, s->ppid, s->uid, 1,
+                     screen->num_counters, s->name, s->name);
+      p->summary = 1;
+      p->ppid = s->ppid;
+      s->row = p;
+    }
+    p->timestamp = now;
+    p->cpu_percent = 100.0 * (s->utime + s->stime) / elapsed;
+    p->cpu_percent_s = 100.0 * s->stime / elapsed;
+    p->cpu_percent_u = 100.0 * s->utime / elapsed;
+    p->mux_ratio = 1.0;
+    for(zz = 0; zz < p->num_events; zz++) {
+      c->prev_values[zz][p->slot] = 0;
+      c->values[zz][p->slot] = s->measured ? s->sums[zz] : 0xffffffff;
+      s->sums[zz] = 0;
+    }
+    s->utime = 0;
+    s->stime = 0;
+    s->num_exits = 0;
+    s->measured = 0;
+    i++;
+  }
+  return num_dead;
+}
+
+
+/*
+ * Update all processes in the list with newly collected statistics.
+ * Tasks are sampled by the workers (see pool.c), then the outcomes are
+ * applied to the list by the main thread. With --uring, the stat files
+ * are read in one batch before, and the groups of counters in another
+ * batch after. With --exits, the tasks that exited meanwhile are
+ * summed in the rows of the summaries.
+ * Return the number of dead processes.
+ */
+int update_proc_list(struct process_list* const list,
+                     const screen_t* const screen,
+                     struct option* const options)
+{
+  struct sample_job job;
+  int    num_dead = 0, num_waiting = 0;
+  int    i, n;
+
+  assert(screen);
+  assert(list && list->proc_ptrs);
+
+  /* Exits first: a stale record may be dropped by the scan */
+  drain_exits(list, options);
+
+  /* add newly created processes/threads */
+  new_processes(list, screen, options);
+
+  n = list->num_tids;
+  if (n > num_alloc_outcomes) {
+    num_alloc_outcomes = n;
+    outcomes = realloc(outcomes, num_alloc_outcomes);
+  }
+  job.list = list;
+  job.options = options;
+  job.outcomes = outcomes;
+
+  if (list->ring)
+    batch_stat_reads(list);
+
+  /* PAPI is not initialised for threads: sample sequentially */
+  if (list->num_papi) {
+    for(i = 0; i < n; i++)
+      sample_one(&job, i);
+  }
+  else
+    pool_run(n, sample_one, &job);
+
+  if (list->ring && batch_counter_reads(list, outcomes)) {
+    if (list->num_papi) {
+      for(i = 0; i < n; i++)
+        finish_one(&job, i);
+    }
+    else
+      pool_run(n, finish_one, &job);
+  }
+
+  for(i = 0; i < n; i++) {
+    struct process* const proc = list->proc_ptrs[i];
+
+    switch(outcomes[i]) {
+    case SAMPLE_SKIP:  /* already dead */
+      num_dead++;
+      continue;
+
+    case SAMPLE_SUMMARY:  /* see publish_summaries */
+      continue;
+
+    case SAMPLE_GONE: {
+      struct pid_info* info = find_pid_info(list, proc->pid);
+      /* The set of threads changed, walk it again at the next scan.
+         No need to force that scan: a new task also moves the most
+         recent PID. */
+      if (info)
+        info->num_threads = 0;
+
+      num_dead++;
+      retire_task(list, proc);
+      continue;
+    }
+    }
+
+    if (list->cgroups)
+      continue;
+
+    if (proc->detached) {
+      if (wants_counters(proc, options))
+        num_waiting++;
+    }
+
+    /* Idle for too long, give the counters back */
+    if (!proc->detached && (outcomes[i] != SAMPLE_ZOMBIE) &&
+        !options->idle && (options->release_delay > 0) &&
+        !is_spawned(proc->tid) &&
+        (proc->timestamp.tv_sec - proc->last_active > options->release_delay))
+      detach_counters(list, proc);
+
+    if (outcomes[i] == SAMPLE_ZOMBIE) {
+      proc->dead = 1;
+      wait_for_child(proc->tid, options);
+    }
+  }
+
+  /* The exits up to now. The records of the tasks, dead or alive,
+     have their last sample. */
+  if (list->taskstats_fd != -1) {
+    drain_exits(list, options);
+    num_dead += publish_summaries(list, screen);
+  }
+
+  if (num_waiting)
+    balance_counters(list, screen, options);
+
+  return num_dead;
+}
+
+
+/* Release the processes that exited since the last refresh, as
+   notified by their pidfds (see exit_fd): they are marked dead and
+   their files are closed right away, instead of at the next refresh.
+   Called by the main loop while it waits. */
+void release_exited(struct process_list* const list)
+{
+  struct epoll_event ev[64];
+  struct process* p;
+  int    i, n, threads = 0;
+
+  if (list->exit_fd == -1)
+    return;
+
+  while ((n = epoll_wait(list->exit_fd, ev, 64, 0)) > 0) {
+    for(i = 0; i < n; i++) {
+      p = ev[i].data.ptr;
+      p->exited = 1;
+      if (p->num_threads > 1)
+        threads = 1;
+      retire_task(list, p);  /* closes the pidfd: no more events */
+    }
+  }
+
+  /* the other threads of these processes */
+  if (threads) {
+    for(p = list->processes; p; p = p->next) {
+      struct process* owner;
+      if (p->dead || p->summary)
+        continue;
+      owner = hash_get(p->pid);
+      if (owner && owner->exited)
+        retire_task(list, p);
+    }
+  }
+}
+
+
+/* Scan list of processes and deallocates the dead ones, compacting the list. */
+void compact_proc_list(struct process_list* const list)
+{
+  struct process* p;
   int i;
 
   for(p = list->processes; p; p = p->next) {
     if (p && p->next && p->next->dead) {
       struct process* to_delete = p->next;
-      hash_del(to_delete->tid);
+      hash_del(to_delete->tid, to_delete);
       p->next = to_delete->next;
-      done_proc(to_delete);
-      free(to_delete);
+      done_proc(list, to_delete);
+      free_proc(list, to_delete);
       list->num_tids--;
     }
   }
   /* special case for 1st element */
   if (list->processes->dead) {
     struct process* to_delete = list->processes;
-    hash_del(to_delete->tid);
+    hash_del(to_delete->tid, to_delete);
     list->processes = to_delete->next;
-    done_proc(to_delete);
-    free(to_delete);
+    done_proc(list, to_delete);
+    free_proc(list, to_delete);
     list->num_tids--;
   }
 
@@ -619,10 +2394,17 @@ void compact_proc_list(struct process_list* const list)
 /*
  * When threads are not displayed, this function accumulates
  * per-thread statistics in the parent process (which is also a
- * thread).
+ * thread). In per-process mode, the %CPU of the parent already
+ * accounts for all threads, and only the threads that existed before
+ * the counters were attached have counters of their own.
+ *
+ * Both current and previous values are summed over the live threads,
+ * so that the variation of the process does not jump when threads
+ * come and go.
  */
 void accumulate_stats(const struct process_list* const list)
 {
+  const struct counter_columns* const c = &list->columns;
   int zz;
   struct process* p;
 
@@ -639,39 +2421,20 @@ void accumulate_stats(const struct process_list* const list)
       assert(owner);
 
       /* accumulate in owner process */
-      owner->cpu_percent += p->cpu_percent;
+      if (!list->per_process)
+        owner->cpu_percent += p->cpu_percent;
+      if (p->mux_ratio < owner->mux_ratio)
+        owner->mux_ratio = p->mux_ratio;
       for(zz = 0; zz < p->num_events; zz++) {
         /* as soon as one thread has invalid value, skip entire process. */
-        if (p->values[zz] == 0xffffffff) {
-          owner->values[zz] = 0xffffffff;
+        if (c->values[zz][p->slot] == 0xffffffff) {
+          c->values[zz][owner->slot] = 0xffffffff;
           break;
         }
-        owner->values[zz] += p->values[zz];
-      }
-    }
-  }
-}
-
-
-/*
- * When switching back from show_threads to no_thread, we need to
- * reset the statistics of the parent thread, because they contain
- * accumulated values, much higher than per-thread value. Failing to
- * do so results in transient erratic displayed values.
- */
-void reset_values(const struct process_list* const list)
-{
-  struct process* p;
-
-  for(p = list->processes; p; p = p->next) {
-    if (p->dead)
-      continue;
-    /* only consider 'main' processes (not threads) */
-    if (p->pid == p->tid) {
-      int zz;
-      p->cpu_percent = 0;
-      for(zz = 0; zz < p->num_events; zz++) {
-        p->values[zz] = 0;
+        if (c->values[zz][owner->slot] != 0xffffffff) {
+          c->values[zz][owner->slot] += c->values[zz][p->slot];
+          c->prev_values[zz][owner->slot] += c->prev_values[zz][p->slot];
+        }
       }
     }
   }
@@ -700,9 +2463,8 @@ void update_name_cmdline(int pid, int name_only)
     while (fgets(line, sizeof(line), f)) {
       if (strncmp(line, "Name:", 5) == 0) {
         sscanf(line, "%*s %s", proc_name);
-        if (p->name)
-          free(p->name);
-        p->name = strdup(proc_name);
+        str_release(p->name);
+        p->name = str_intern(proc_name);
         break;
       }
     }
@@ -711,10 +2473,9 @@ void update_name_cmdline(int pid, int name_only)
 
   if (!name_only) {  /* update command line */
     char  buffer[100];
-    if (p->cmdline)
-      free(p->cmdline);
+    str_release(p->cmdline);
 
     get_cmdline(pid, buffer, sizeof(buffer));
-    p->cmdline = strdup(buffer);
+    p->cmdline = str_intern(buffer);
   }
 }
@@ -14,12 +14,13 @@
 #include <stdint.h>
 #include <sys/time.h>
 #include <sys/types.h>
+#include <time.h>
 
 #include "screen.h"
 
 
-#define MAX_EVENTS 16
 #define TXT_LEN   200  /* max size of the text representation (or row) */
+#define STAT_BUF_LEN 512  /* fits /proc/PID/task/TID/stat */
 
 
 /* An instance of this union is owned by each process. It is used to
@@ -36,6 +37,8 @@ union sorting_column {
 struct process {
   pid_t    tid;           /* thread ID */
   pid_t    pid;           /* process ID. For owning process, tip == pid */
+  pid_t    ppid;          /* parent process */
+  uid_t    uid;           /* owner of the process */
   short    proc_id;       /* processor ID on which process was last seen */
   short    num_threads;   /* number of threads in brotherhood */
   int      num_events;
@@ -44,25 +47,34 @@ struct process {
   double   cpu_percent;   /* %CPU as displayed by top */
   double   cpu_percent_s; /* %CPU system */
   double   cpu_percent_u; /* %CPU user */
+  double   cpu_avg;       /* moving average of %CPU, for the files budget */
 
   struct timeval timestamp;         /* timestamp of last update */
   unsigned long prev_cpu_time_s;    /* system */
   unsigned long prev_cpu_time_u;    /* user */
-
-  int       fd[MAX_EVENTS];           /* file handles */
-  uint64_t  values[MAX_EVENTS];       /* values read from counters */
-  uint64_t  prev_values[MAX_EVENTS];  /* previous iteration */
-  uint64_t  papi[MAX_EVENTS];
+  time_t   last_active;             /* last refresh the task ran */
+  unsigned long long starttime;     /* identity of the tid, 0: not known yet */
+  ino_t    ino;           /* cgroup rows: the cgroup (the tid is cut from it) */
+
+  int       slot;     /* index in the counter columns, see below */
+  int       stat_fd;                  /* /proc/PID/task/TID/stat */
+  int       pidfd;    /* main thread: notifies the exit, -1 if none */
+  int       group_leader;  /* index of the leader in fd, -1: no group */
+  int*      cpu_fd;  /* cgroup mode: one handle per counter and per CPU */
+  double    mux_ratio;  /* min fraction of the period counters were running */
   char* txt;  /* text representation of the process (what is displayed) */
 
   union sorting_column u;
 
-  char* username;
-  char* cmdline;       /* command line */
-  char* name;          /* name of process */
+  const char* username;  /* shared, see users.c */
+  const char* cmdline;  /* command line, shared (see intern.c) */
+  const char* name;     /* name of process, shared */
 
   unsigned int dead : 1;  /* is the process dead? */
   unsigned int skip : 1;  /* do not display, for any reason (dead, idle...) */
+  unsigned int detached : 1;  /* no counters (idle, or files limit) */
+  unsigned int exited : 1;    /* process exited, notified by its pidfd */
+  unsigned int summary : 1;   /* row of exited tasks (--exits), no task */
 #if 0
   unsigned int attention : 1;
 #endif
@@ -70,18 +82,85 @@ struct process {
 };
 
 
+struct pid_info;
+struct cgroup_entry;
+struct proc_slab;
+struct uring;
+struct exit_summary;
+
+
+/* Sampling state of the counters, one column per counter, indexed by
+   the slot of the task: the values of a counter for all tasks are
+   contiguous, e.g. values[zz][p->slot]. */
+struct counter_columns {
+  int        num_columns;  /* number of counters of the screen */
+  int        num_slots;
+  int        num_alloc_slots;
+  int**      fd;           /* file handles */
+  uint64_t** ids;          /* IDs of the counters in the group */
+  uint64_t** values;       /* values read from counters */
+  uint64_t** prev_values;  /* previous iteration */
+  uint64_t** scaled;       /* own counts since attached, scaled */
+  uint64_t** raw;          /* last values read, not scaled */
+  uint64_t** enabled;      /* time enabled at last read */
+  uint64_t** running;      /* time running at last read */
+  int*       papi;         /* per counter: position in the PAPI eventset,
+                              -1 if not a PAPI counter */
+};
+
 /* List of processes/threads */
 struct process_list {
   int  num_tids;
   int  num_alloc;
   pid_t most_recent_pid;
+  int   events_fd;      /* proc connector socket, -1 when scanning /proc */
+  int   events_failed;  /* could not subscribe, do not try again */
+  int   events_rescan;  /* full scan needed (start, or lost events) */
+  int   exit_fd;        /* epoll of the pidfds, -1 if not supported */
+  int   taskstats_fd;   /* exit records (--exits), -1 if not used */
+  int   per_process;    /* threads not shown: counters inherited by threads */
+  int   cgroups;        /* rows are cgroups instead of tasks */
+  int   group_reads;    /* cleared when the kernel refuses event groups */
+
+  struct cgroup_entry* cgroup_entries;  /* result of the last cgroup scan */
+  int   num_alloc_cgroups;
+  int   cgroup_collisions;  /* cgroup rows left out of the hash table */
+
+  struct pid_info* pids;  /* per-PID discovery cache, sorted by PID */
+  int   num_pids;
+  int   num_sorted_pids;
+  int   num_alloc_pids;
+  int   scan_generation;
 
   struct process* processes;
   struct process** proc_ptrs;
+
+  struct proc_slab* slabs;       /* storage of the records */
+  struct process*   free_procs;  /* recycled records, linked by 'next' */
+  struct counter_columns columns;
+  int   row_len;  /* size of the text rows */
+
+  int*  papi_codes;          /* PAPI events of the screen, eventset order */
+  int   num_papi;
+  int*  free_eventsets;      /* eventsets of dead tasks, ready for reuse */
+  int   num_free_eventsets;
+  int   num_alloc_eventsets;
+
+  struct uring* ring;  /* batched reads (--uring), NULL if not used */
+  char* io_buf;        /* per task of proc_ptrs: stat file, then group */
+  int*  io_res;        /* results of the reads, two per task */
+  int   io_stride;
+  int   num_alloc_io;
+
+  struct exit_summary* summaries;  /* exited tasks, per parent and name */
+  int   num_summaries;
+  int   num_alloc_summaries;
+  struct timeval last_fold;  /* when the summaries were last updated */
 };
 
 
-struct process_list* init_proc_list();
+struct process_list* init_proc_list(const screen_t* const screen,
+                                    const struct option* const options);
 void done_proc_list(struct process_list*);
 void new_processes(struct process_list* const list,
                    const screen_t* const screen,
@@ -90,9 +169,10 @@ int  update_proc_list(struct process_list* const,
                       const screen_t* const,
                       struct option* const);
 void compact_proc_list(struct process_list* const);
+void release_exited(struct process_list* const);
 void accumulate_stats(const struct process_list* const);
-void reset_values(const struct process_list* const);
 
 void update_name_cmdline(int pid, int name_only);
+void handle_error(int retval);
 
 #endif  /* _PROCESS_H */
@@ -28,6 +28,7 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
+#include <papi.h>
 #include <errno.h>
 
 #include "conf.h"
@@ -62,6 +63,7 @@ static void check_counters_used(expression* e, screen_t* s, int* error)
         strcmp(e->ele->alias, "CPU_SYS") == 0 ||
         strcmp(e->ele->alias, "CPU_USER") == 0 ||
         strcmp(e->ele->alias, "NUM_THREADS") == 0 ||
+        strcmp(e->ele->alias, "MUX_RATIO") == 0 ||
         strcmp(e->ele->alias, "PROC_ID") == 0)
       return ;
 
@@ -86,10 +88,29 @@ static void check_counters_used(expression* e, screen_t* s, int* error)
 }
 
 
+/* The PAPI events of the screen form the eventset of each task, in
+   the order of the counters. */
+static void number_papi_counters(screen_t* const s)
+{
+  int i, n = 0;
+
+  for(i=0; i < s->num_counters; i++) {
+    if (s->counters[i].papi_code != PAPI_NULL)
+      s->counters[i].papi_idx = n++;
+    else
+      s->counters[i].papi_idx = -1;
+  }
+}
+
+
 /* delete unmarked counters */
 static void delete_and_shift_counters(int sc, int co)
 {
   int i;
+
+  /* columns refer to the counters by index */
+  dag_remove_counter(&screens[sc]->dag, co);
+
   int nbc = screens[sc]->num_counters;
   counter_t* tmp = &screens[sc]->counters[co];
 
@@ -102,8 +123,10 @@ static void delete_and_shift_counters(int sc, int co)
     tmp->config = screens[sc]->counters[i+1].config;
     tmp->alias  = screens[sc]->counters[i+1].alias;
     tmp->used   = screens[sc]->counters[i+1].used;
+    tmp->papi_code = screens[sc]->counters[i+1].papi_code;
   }
   screens[sc]->num_counters--;
+  number_papi_counters(screens[sc]);
 }
 
 
@@ -139,6 +162,8 @@ static screen_t* alloc_screen()
   s->num_alloc_counters = 0;
   s->num_columns = 0;
   s->num_alloc_columns = 0;
+  s->dag.num_nodes = 0;
+  s->dag.nodes = NULL;
 
   return s;
 }
@@ -151,6 +176,7 @@ static void init_column(column_t* c)
   c->empty_field = NULL;
   c->error_field = NULL;
   c->expression = NULL;
+  c->node = -1;
   c->description = NULL;
 }
 
@@ -365,16 +391,8 @@ int add_counter(screen_t* const s, char* alias, char* config, char* type)
   uint64_t int_conf = 0;
   uint32_t int_type = 0;
   int err=0;
-  int n;
   expression* expr = NULL;
 
-  if (s->num_counters >=  MAX_EVENTS) {
-    error_printf("Too many counters (max %d) in screen '%s', ignoring '%s'\n"
-                 "(change MAX_EVENTS and recompile)\n",
-                 MAX_EVENTS, s->name, alias);
-    return -1;
-  }
-
   int_type = get_counter_type(type, &err);
 
   if (err > 0) {
@@ -397,19 +415,7 @@ int add_counter(screen_t* const s, char* alias, char* config, char* type)
     return -1;
   }
 
-  n = s->num_counters;
-  /* check max available hw counter */
-  if (n == s->num_alloc_counters) {
-    s->counters = realloc(s->counters, sizeof(counter_t) * (n + alloc_chunk));
-    s->num_alloc_counters += alloc_chunk;
-  }
-  /* initialisation */
-  s->counters[n].used = 0;
-  s->counters[n].type = int_type;
-  s->counters[n].config = int_conf;
-  s->counters[n].alias = strdup(alias);
-  s->num_counters++;
-  return n;
+  return add_counter_by_value(s, alias, int_conf, int_type);
 }
 
 
@@ -418,13 +424,7 @@ int add_counter_by_value(screen_t* const s, char* alias,
                          uint64_t config_val, uint32_t type_val)
 {
   int n = s->num_counters;
-
-  if (n >= MAX_EVENTS) {
-    error_printf("Too many counters (max %d) in screen '%s', ignoring '%s'\n"
-                 "(change MAX_EVENTS and recompile)",
-                 MAX_EVENTS, s->name,  alias);
-    return -1;
-  }
+  int code = PAPI_NULL;
 
   /* check max available hw counter */
   if (n == s->num_alloc_counters) {
@@ -436,7 +436,12 @@ int add_counter_by_value(screen_t* const s, char* alias,
   s->counters[n].config = config_val;
   s->counters[n].alias = strdup(alias);
   s->counters[n].type = type_val;
+  /* resolved once, for all the tasks */
+  if (PAPI_event_name_to_code(alias, &code) != PAPI_OK)
+    code = PAPI_NULL;
+  s->counters[n].papi_code = code;
   s->num_counters++;
+  number_papi_counters(s);
   return n;
 }
 
@@ -446,6 +451,7 @@ int add_column(screen_t* const s, char* header, char* format, char* desc,
 {
   int col_width, err=0;
   int n = s->num_columns;
+  program_t* prog;
 
   expression* e = parser_expression(expr);
 
@@ -462,12 +468,22 @@ int add_column(screen_t* const s, char* header, char* format, char* desc,
     return -1;
   }
 
+  prog = compile_expression(e, s->counters, s->num_counters);
+  if (prog == NULL) {
+    free_expression(e);
+    error_printf("Invalid expression in column '%s', screen '%s': column ignored\n",
+                 header, s->name);
+    return -1;
+  }
+
   if (n == s->num_alloc_columns) {
     s->columns = realloc(s->columns, sizeof(column_t) * (n + alloc_chunk));
     s->num_alloc_columns += alloc_chunk;
   }
   init_column(&s->columns[n]);
   s->columns[n].expression = e;
+  s->columns[n].node = dag_add_program(&s->dag, prog);
+  free_program(prog);
   s->columns[n].header = strdup(header);
   s->columns[n].format = strdup(format);
 
@@ -714,6 +730,7 @@ void delete_screen(screen_t* s)
   free(s->desc);
   delete_counters(s->counters, s->num_counters);
   delete_columns(s->columns, s->num_columns);
+  free_dag(&s->dag);
   free(s);
 }
 
@@ -23,7 +23,8 @@ typedef struct {
   uint64_t  config;  /* Constant defined in configuration */
   char* alias;
   int used;
-  int papi_idx;
+  int papi_code;  /* PAPI event of the alias, PAPI_NULL if none */
+  int papi_idx;   /* position in the PAPI eventset of the tasks, or -1 */
 } counter_t;
 
 
@@ -33,6 +34,7 @@ typedef struct {
   char* empty_field;
   char* error_field;
   expression* expression;
+  int         node;  /* node of the result in the DAG of the screen */
   char* description;
 } column_t;
 
@@ -46,6 +48,7 @@ typedef struct {
   int        num_columns;
   int        num_alloc_columns;
   column_t*  columns;
+  dag_t      dag;  /* compiled expressions of all columns */
 } screen_t;
 
 
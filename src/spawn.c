@@ -144,6 +144,13 @@ void start_child()
 }
 
 
+/* Is 'pid' the command launched by tiptop? */
+int is_spawned(pid_t pid)
+{
+  return (my_child != 0) && (pid == my_child);
+}
+
+
 void wait_for_child(pid_t pid, struct option* options)
 {
   /* only wait for my child */
@@ -18,5 +18,6 @@
 void spawn(char** argv);
 void start_child(void);
 void wait_for_child(pid_t pid, struct option* options);
+int  is_spawned(pid_t pid);
 
 #endif  /* _SPAWN_H */
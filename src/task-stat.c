@@ -0,0 +1,110 @@
+/*
+ * This file is part of tiptop.
+ *
+ * Author: Erven ROHOU
+ * Copyright (c) 2012 Inria
+ *
+ * License: GNU General Public License version 2.
+ *
+ */
+
+/* Parser for /proc/PID/task/TID/stat. The line is read at each
+   refresh for each task, it must be cheap: single pass, no
+   allocation, no stdio.
+
+   The second field is the command name in parentheses. It may
+   contain anything, including spaces and ')'. The kernel does not
+   escape it, but it is the only field that can contain ')', hence
+   the numbers start after the last ')' of the line. */
+
+#include <string.h>
+
+#include "task-stat.h"
+
+
+/* Parse a (possibly negative) decimal number at *p, and move *p past
+   it and the following separator. */
+static inline long long next_field(const char** p, const char* end)
+{
+  const char* s = *p;
+  long long   val = 0;
+  int         neg = 0;
+
+  if ((s < end) && (*s == '-')) {
+    neg = 1;
+    s++;
+  }
+  while ((s < end) && ((unsigned)(*s - '0') < 10)) {
+    val = 10*val + (*s - '0');
+    s++;
+  }
+  if ((s < end) && (*s == ' '))
+    s++;
+  *p = s;
+  return neg ? -val : val;
+}
+
+
+/* Skip one field. */
+static inline void skip_field(const char** p, const char* end)
+{
+  const char* s = *p;
+  while ((s < end) && (*s != ' '))
+    s++;
+  if (s < end)
+    s++;
+  *p = s;
+}
+
+
+/* Extract the interesting fields from the 'len' bytes of 'buf'.
+   Return 0 on success, -1 if the line is truncated before stime. */
+int parse_task_stat(const char* buf, int len, struct task_stat* st)
+{
+  const char* end = buf + len;
+  const char* p;
+  int field;
+
+  /* find the last ')', end of the command name */
+  p = end;
+  while ((p > buf) && (p[-1] != ')'))
+    p--;
+  if (p == buf)
+    return -1;
+
+  /* p points after ')', next is " S " */
+  if (end - p < 3)
+    return -1;
+  st->state = p[1];
+  p += 3;
+  st->ppid = next_field(&p, end);
+
+  /* fields 5 to 13 */
+  for(field = 5; field < 14; field++)
+    skip_field(&p, end);
+
+  if (p >= end)
+    return -1;
+  st->utime = next_field(&p, end);
+  if (p >= end)
+    return -1;
+  st->stime = next_field(&p, end);
+
+  /* fields 16 to 18 */
+  for(field = 16; field < 19; field++)
+    skip_field(&p, end);
+  st->nice = next_field(&p, end);
+  st->num_threads = next_field(&p, end);
+  skip_field(&p, end);
+  st->starttime = next_field(&p, end);
+
+  /* fields 23 to 38 */
+  for(field = 23; field < 39; field++)
+    skip_field(&p, end);
+  if (p < end)
+    st->processor = next_field(&p, end);
+  else
+    st->processor = -1;
+
+  return 0;
+}
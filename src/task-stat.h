@@ -0,0 +1,28 @@
+/*
+ * This file is part of tiptop.
+ *
+ * Author: Erven ROHOU
+ * Copyright (c) 2012 Inria
+ *
+ * License: GNU General Public License version 2.
+ *
+ */
+
+#ifndef _TASK_STAT_H
+#define _TASK_STAT_H
+
+/* Fields of /proc/PID/task/TID/stat used by tiptop (see "man proc"). */
+struct task_stat {
+  char           state;        /* field 3 */
+  int            ppid;         /* field 4 */
+  unsigned long  utime;        /* field 14, in clock ticks */
+  unsigned long  stime;        /* field 15, in clock ticks */
+  long           nice;         /* field 19 */
+  long           num_threads;  /* field 20 */
+  unsigned long long starttime;  /* field 22, in clock ticks after boot */
+  int            processor;    /* field 39, -1 if not available */
+};
+
+int parse_task_stat(const char* buf, int len, struct task_stat* st);
+
+#endif  /* _TASK_STAT_H */
@@ -0,0 +1,265 @@
+/*
+ * This file is part of tiptop.
+ *
+ * Author: Erven ROHOU
+ * Copyright (c) 2012 Inria
+ *
+ * License: GNU General Public License version 2.
+ *
+ */
+
+/* Exit accounting with the taskstats interface (generic netlink). Once
+   a socket is registered for all CPUs, the kernel sends it a record
+   for each task that exits: CPU times, command name, parent. Tasks
+   that live less than a refresh, never seen by tiptop otherwise, are
+   accounted for this way (see --exits).
+
+   Registering requires CAP_NET_ADMIN. When the socket cannot be set
+   up, the caller does without. */
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <linux/genetlink.h>
+#include <linux/netlink.h>
+#include <linux/taskstats.h>
+
+#include "taskstats.h"
+
+/* Large receive buffer, we only drain the socket once per refresh. */
+#define RCVBUF_SIZE (4 * 1024 * 1024)
+
+#define NLA_DATA(na) ((char*)(na) + NLA_HDRLEN)
+
+/* Messages received but not yet consumed by taskstats_next. */
+static char  msg_buf[16384] __attribute__((aligned(NLMSG_ALIGNTO)));
+static int   msg_len = 0;
+static struct nlmsghdr* msg_ptr = NULL;
+
+static int   family_id = 0;   /* of TASKSTATS, given by the controller */
+static char  cpumask[100];    /* the CPUs we registered for */
+
+
+/* Send a generic netlink request carrying one attribute. */
+static int send_cmd(int fd, int type, int cmd, int attr,
+                    const void* data, int len)
+{
+  struct {
+    struct nlmsghdr   n;
+    struct genlmsghdr g;
+    char              attrs[128];
+  } req;
+  struct nlattr* na;
+
+  if (NLA_HDRLEN + len > (int)sizeof(req.attrs))
+    return -1;
+
+  memset(&req, 0, sizeof(req));
+  req.n.nlmsg_type = type;
+  req.n.nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK;
+  req.g.cmd = cmd;
+  req.g.version = 1;
+
+  na = (struct nlattr*)req.attrs;
+  na->nla_type = attr;
+  na->nla_len = NLA_HDRLEN + len;
+  memcpy(NLA_DATA(na), data, len);
+  req.n.nlmsg_len = NLMSG_LENGTH(GENL_HDRLEN) + NLA_ALIGN(na->nla_len);
+
+  if (send(fd, &req, req.n.nlmsg_len, 0) != (ssize_t)req.n.nlmsg_len)
+    return -1;
+  return 0;
+}
+
+
+/* Wait for the acknowledgement of a request. The ID of the family is
+   picked on the way, if present. Return 0, or -1 with errno set. */
+static int wait_ack(int fd)
+{
+  for(;;) {
+    struct nlmsghdr* nlh;
+    int len = recv(fd, msg_buf, sizeof(msg_buf), 0);
+
+    if (len <= 0)
+      return -1;
+
+    for(nlh = (struct nlmsghdr*)msg_buf; NLMSG_OK(nlh, len);
+        nlh = NLMSG_NEXT(nlh, len)) {
+      if (nlh->nlmsg_type == NLMSG_ERROR) {
+        const struct nlmsgerr* err = NLMSG_DATA(nlh);
+        if (err->error == 0)
+          return 0;
+        errno = -err->error;
+        return -1;
+      }
+
+      if (nlh->nlmsg_type == GENL_ID_CTRL) {  /* CTRL_CMD_NEWFAMILY */
+        struct nlattr* na = (struct nlattr*)((char*)NLMSG_DATA(nlh) +
+                                             GENL_HDRLEN);
+        int left = nlh->nlmsg_len - NLMSG_LENGTH(GENL_HDRLEN);
+
+        while ((left >= NLA_HDRLEN) && (na->nla_len >= NLA_HDRLEN) &&
+               (na->nla_len <= left)) {
+          if (na->nla_type == CTRL_ATTR_FAMILY_ID)
+            family_id = *(__u16*)NLA_DATA(na);
+          left -= NLA_ALIGN(na->nla_len);
+          na = (struct nlattr*)((char*)na + NLA_ALIGN(na->nla_len));
+        }
+      }
+      /* other messages (early exit records) are dropped */
+    }
+  }
+}
+
+
+/* Open the socket, and register for the exits on all possible CPUs.
+   Return the socket, or -1 (with errno set) if not available. */
+int taskstats_open()
+{
+  struct sockaddr_nl addr;
+  FILE* f;
+  int   fd, size = RCVBUF_SIZE;
+
+  fd = socket(PF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_GENERIC);
+  if (fd == -1)
+    return -1;
+
+  /* Try hard to get a big buffer, bursts of exits are common. */
+  if (setsockopt(fd, SOL_SOCKET, SO_RCVBUFFORCE, &size, sizeof(size)) == -1)
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+
+  memset(&addr, 0, sizeof(addr));
+  addr.nl_family = AF_NETLINK;
+  if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) == -1)
+    goto fail;
+
+  /* the mask must be a subset of the possible CPUs, e.g. "0-7" */
+  strcpy(cpumask, "0");
+  f = fopen("/sys/devices/system/cpu/possible", "r");
+  if (f) {
+    if (fscanf(f, "%99s", cpumask) != 1)
+      strcpy(cpumask, "0");
+    fclose(f);
+  }
+
+  family_id = 0;
+  if ((send_cmd(fd, GENL_ID_CTRL, CTRL_CMD_GETFAMILY, CTRL_ATTR_FAMILY_NAME,
+                TASKSTATS_GENL_NAME, sizeof(TASKSTATS_GENL_NAME)) == -1) ||
+      (wait_ack(fd) == -1))
+    goto fail;
+  if (family_id == 0) {
+    errno = ENOENT;
+    goto fail;
+  }
+
+  if ((send_cmd(fd, family_id, TASKSTATS_CMD_GET,
+                TASKSTATS_CMD_ATTR_REGISTER_CPUMASK,
+                cpumask, strlen(cpumask) + 1) == -1) ||
+      (wait_ack(fd) == -1))
+    goto fail;
+
+  msg_len = 0;
+  msg_ptr = NULL;
+  return fd;
+
+ fail: {
+    int err = errno;
+    close(fd);
+    errno = err;
+    return -1;
+  }
+}
+
+
+/* Fill in 'ex' from the stats of a task, 'len' bytes at 'data'. Older
+   kernels send a shorter structure. */
+static void fill_exit(struct task_exit* ex, const void* data, int len)
+{
+  struct taskstats ts;
+
+  memset(&ts, 0, sizeof(ts));
+  memcpy(&ts, data, (len < (int)sizeof(ts)) ? len : (int)sizeof(ts));
+
+  ex->tid = ts.ac_pid;
+  ex->pid = 0;
+#if TASKSTATS_VERSION >= 12
+  if (ts.version >= 12)
+    ex->pid = ts.ac_tgid;
+#endif
+  ex->ppid = ts.ac_ppid;
+  ex->uid = ts.ac_uid;
+  ex->utime = ts.ac_utime;
+  ex->stime = ts.ac_stime;
+  strncpy(ex->name, ts.ac_comm, sizeof(ex->name) - 1);
+  ex->name[sizeof(ex->name) - 1] = '\0';
+}
+
+
+/* Retrieve the next pending exit record, without blocking. Return 1
+   when 'ex' is filled in, 0 when no record is pending, and -1 when
+   records were lost (the socket buffer overflowed). */
+int taskstats_next(int fd, struct task_exit* ex)
+{
+  for(;;) {
+    struct nlmsghdr* nlh;
+    struct nlattr*   na;
+    int    left;
+
+    if (!msg_ptr || !NLMSG_OK(msg_ptr, msg_len)) {
+      msg_len = recv(fd, msg_buf, sizeof(msg_buf), MSG_DONTWAIT);
+      if (msg_len <= 0) {
+        int lost = (msg_len == -1) && (errno == ENOBUFS);
+        msg_len = 0;
+        msg_ptr = NULL;
+        return lost ? -1 : 0;
+      }
+      msg_ptr = (struct nlmsghdr*)msg_buf;
+      continue;
+    }
+
+    nlh = msg_ptr;
+    msg_ptr = NLMSG_NEXT(msg_ptr, msg_len);
+    if (nlh->nlmsg_type != family_id)
+      continue;
+
+    /* The record of the task is nested in TASKSTATS_TYPE_AGGR_PID. The
+       one of the process (TASKSTATS_TYPE_AGGR_TGID, sent with the last
+       thread) has no CPU times, skip it. */
+    na = (struct nlattr*)((char*)NLMSG_DATA(nlh) + GENL_HDRLEN);
+    left = nlh->nlmsg_len - NLMSG_LENGTH(GENL_HDRLEN);
+    while ((left >= NLA_HDRLEN) && (na->nla_len >= NLA_HDRLEN) &&
+           (na->nla_len <= left)) {
+      if (na->nla_type == TASKSTATS_TYPE_AGGR_PID) {
+        struct nlattr* in = (struct nlattr*)NLA_DATA(na);
+        int in_left = na->nla_len - NLA_HDRLEN;
+
+        while ((in_left >= NLA_HDRLEN) && (in->nla_len >= NLA_HDRLEN) &&
+               (in->nla_len <= in_left)) {
+          if (in->nla_type == TASKSTATS_TYPE_STATS) {
+            fill_exit(ex, NLA_DATA(in), in->nla_len - NLA_HDRLEN);
+            return 1;
+          }
+          in_left -= NLA_ALIGN(in->nla_len);
+          in = (struct nlattr*)((char*)in + NLA_ALIGN(in->nla_len));
+        }
+      }
+      left -= NLA_ALIGN(na->nla_len);
+      na = (struct nlattr*)((char*)na + NLA_ALIGN(na->nla_len));
+    }
+  }
+}
+
+
+void taskstats_close(int fd)
+{
+  if (fd == -1)
+    return;
+  send_cmd(fd, family_id, TASKSTATS_CMD_GET,
+           TASKSTATS_CMD_ATTR_DEREGISTER_CPUMASK,
+           cpumask, strlen(cpumask) + 1);
+  close(fd);
+}
@@ -0,0 +1,33 @@
+/*
+ * This file is part of tiptop.
+ *
+ * Author: Erven ROHOU
+ * Copyright (c) 2012 Inria
+ *
+ * License: GNU General Public License version 2.
+ *
+ */
+
+#ifndef _TASKSTATS_H
+#define _TASKSTATS_H
+
+#include <sys/types.h>
+
+
+/* Accounting record sent by the kernel when a task exits. */
+struct task_exit {
+  pid_t tid;   /* task that exited */
+  pid_t pid;   /* process it belonged to, 0 if the kernel does not tell */
+  pid_t ppid;  /* parent process */
+  uid_t uid;
+  unsigned long long utime;  /* microseconds */
+  unsigned long long stime;  /* microseconds */
+  char  name[32];
+};
+
+
+int  taskstats_open(void);
+int  taskstats_next(int fd, struct task_exit* ex);
+void taskstats_close(int fd);
+
+#endif  /* _TASKSTATS_H */
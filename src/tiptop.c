@@ -32,12 +32,14 @@
 #include <unistd.h>
 #include <papi.h>
 
+#include "cgroup.h"
 #include "conf.h"
 #include "debug.h"
 #include "error.h"
 #include "helpwin.h"
 #include "options.h"
 #include "pmc.h"
+#include "pool.h"
 #include "process.h"
 #include "requisite.h"
 #include "screen.h"
@@ -121,11 +123,13 @@ static int cmp_string(const void* p1, const void* p2)
 {
   struct process* proc1 = *(struct process**)p1;
   struct process* proc2 = *(struct process**)p2;
+  const char* s1 = options.show_cmdline ? proc1->cmdline : proc1->name;
+  const char* s2 = options.show_cmdline ? proc2->cmdline : proc2->name;
   int res;
-  if (options.show_cmdline)
-    res = strcmp(proc1->cmdline, proc2->cmdline);
-  else
-    res = strcmp(proc1->name, proc2->name);
+
+  if (s1 == s2)  /* interned strings, same pointer when equal */
+    return 0;
+  res = strcmp(s1, s2);
   if (sorting_order == ASCENDING)
     return res;
   else
@@ -133,18 +137,69 @@ static int cmp_string(const void* p1, const void* p2)
 }
 
 
+/* Tasks to display at this refresh, and the values of the nodes of
+   the screen (node by node), built by build_rows. */
+static struct process** visible = NULL;
+static int*    visible_slots = NULL;
+static double* col_values = NULL;
+static char*   col_errors = NULL;
+static int     num_alloc_visible = 0;
+static int     num_alloc_values = 0;
+
+
+/* Select the tasks to display. */
+static int select_rows(struct process_list* proc_list)
+{
+  struct process* p;
+  int n = 0;
+
+  if (proc_list->num_tids > num_alloc_visible) {
+    num_alloc_visible = proc_list->num_tids;
+    visible = realloc(visible, num_alloc_visible * sizeof(struct process*));
+    visible_slots = realloc(visible_slots, num_alloc_visible * sizeof(int));
+  }
+
+  for(p = proc_list->processes; p; p = p->next) {
+    p->skip = 1;  /* first, assume not ready */
+
+
+    /* dead, not changing anymore, the row should be up-to-date. */
+    if ((p->dead) && (!options.sticky))
+      continue;
+
+    /* not active, skip */
+    if (!options.idle && (p->cpu_percent < options.cpu_threshold))
+      continue;
+
+    /* only some tasks are monitored, skip those that do not qualify */
+    if (((options.only_pid) && (p->tid != options.only_pid)) ||
+        (options.only_name && options.show_cmdline &&
+                                  !strstr(p->cmdline, options.only_name)) ||
+        (options.only_name && !options.show_cmdline &&
+                                  !strstr(p->name, options.only_name)))
+      continue;
+
+    visible[n] = p;
+    visible_slots[n] = p->slot;
+    n++;
+  }
+  return n;
+}
+
+
 /* For each process/thread in the list, generate the text form, ready
- * to be printed.
+ * to be printed. The columns are first computed for all displayed
+ * tasks, one column at a time.
  */
 static void build_rows(struct process_list* proc_list, screen_t* s, int width)
 {
   int row_width;
-  struct process* p;
-  assert(TXT_LEN > 20);
+  int num, col, i;
+  assert(proc_list->row_len > 20);
 
 
 
-  row_width = TXT_LEN;
+  row_width = proc_list->row_len;
   if ((width != -1) && (width < row_width))
     row_width = width;
 
@@ -160,34 +215,29 @@ static void build_rows(struct process_list* proc_list, screen_t* s, int width)
   else
     sorting_fun = cmp_double;  /* (computed) expression */
 
-  /* For all processes/threads */
-  for(p = proc_list->processes; p; p = p->next) {
-    int   col, written;
+  num = select_rows(proc_list);
+
+  /* terms shared by several columns are computed once */
+  if (num * s->dag.num_nodes > num_alloc_values) {
+    num_alloc_values = num * s->dag.num_nodes;
+    col_values = realloc(col_values, num_alloc_values * sizeof(double));
+    col_errors = realloc(col_errors, num_alloc_values);
+  }
+  evaluate_dag(&s->dag, proc_list, visible, visible_slots, num,
+               col_values, col_errors);
+
+  /* For all displayed processes/threads */
+  for(i = 0; i < num; i++) {
+    struct process* const p = visible[i];
+    int   written;
     char* row = p->txt;  /* the row we are building */
     int   remaining = row_width;  /* remaining bytes in row */
     int   thr = ' ';
 
-    p->skip = 1;  /* first, assume not ready */
-
-
-    /* dead, not changing anymore, the row should be up-to-date. */
-    if ((p->dead) && (!options.sticky))
-      continue;
-
-    /* not active, skip */
-    if (!options.idle && (p->cpu_percent < options.cpu_threshold))
-      continue;
-
-    /* only some tasks are monitored, skip those that do not qualify */
-    if (((options.only_pid) && (p->tid != options.only_pid)) ||
-        (options.only_name && options.show_cmdline &&
-                                  !strstr(p->cmdline, options.only_name)) ||
-        (options.only_name && !options.show_cmdline &&
-                                  !strstr(p->name, options.only_name)))
-      continue;
-
     if (active_col == -1)  /* column -1 is the PID */
       p->u.i = p->tid;
+    else if (active_col < s->num_columns)
+      p->u.d = col_values[s->columns[active_col].node * num + i];
 
     /* display a '+' or '-' sign after processes made of multiple threads */
     if (p->num_threads > 1) {
@@ -206,20 +256,12 @@ static void build_rows(struct process_list* proc_list, screen_t* s, int width)
     remaining -= written;
 
     for(col = 0; col < s->num_columns; col++) {
-      double res = 0;
-      int error = 0;  /* used to track error situations requiring an
-                         error_field (code 1) or an empty_field (code 2) */
+      const int node = s->columns[col].node;
+      const double res = col_values[node * num + i];
+      const int error = col_errors[node * num + i];  /* error_field (code 1)
+                                                        or empty_field (2) */
       const char* const fmt = s->columns[col].format;
 
-      /* zero the sorting field. The double '.d' is the longest field. */
-      if (active_col == col)
-        p->u.d = 0.0;
-
-      res = evaluate_column_expression(s->columns[col].expression,
-                                s->counters,
-                                s->num_counters,
-                                p, &error);
-
       if (error == 1)
         written = snprintf(row, remaining, "%s", s->columns[col].error_field);
       else if (error == 2)
@@ -227,8 +269,6 @@ static void build_rows(struct process_list* proc_list, screen_t* s, int width)
       else {
         written = snprintf(row, remaining, fmt, res);
       }
-      if (active_col == col)
-        p->u.d = res;
 
       /* man snprintf: The functions snprintf() and vsnprintf() do not
        write more than size bytes (including the trailing '\0').  If
@@ -267,6 +307,33 @@ static void build_rows(struct process_list* proc_list, screen_t* s, int width)
 }
 
 
+/* Wait for the delay (tv), or until a key is pressed on 'key_fd' (-1
+   in batch mode). Processes that exit in the meantime are released
+   right away, then the wait resumes: Linux leaves the time left in
+   tv. As select, return >0 if a key was pressed, 0 when the delay
+   elapsed, -1 when a signal (such as SIGCHLD) interrupted the wait,
+   which forces a refresh. */
+static int wait_delay(struct process_list* proc_list, int key_fd)
+{
+  const int exit_fd = proc_list->exit_fd;
+  fd_set fds;
+  int    n;
+
+  for(;;) {
+    FD_ZERO(&fds);
+    if (key_fd != -1)
+      FD_SET(key_fd, &fds);
+    if ((exit_fd != -1) && (exit_fd < FD_SETSIZE))
+      FD_SET(exit_fd, &fds);
+    n = select(1 + (key_fd > exit_fd ? key_fd : exit_fd), &fds, NULL, NULL,
+               &tv);
+    if ((n <= 0) || ((key_fd != -1) && FD_ISSET(key_fd, &fds)))
+      return n;
+    release_exited(proc_list);
+  }
+}
+
+
 /* Main execution loop in batch mode. Builds the list of processes,
  * collects statistics, and prints. Repeats after some delay.
  */
@@ -397,10 +464,10 @@ static void batch_mode(struct process_list* proc_list, screen_t* screen)
     if ((num_dead) && (!options.sticky))
       compact_proc_list(proc_list);
 
-    /* Wait some delay. Note that this syscall may be interrupted when
-       we receive a signal, such as SICHLD. This is ok, it will force
-       a refresh. */
-    select(0, NULL, NULL, NULL, &tv);
+    /* Wait some delay. Note that this may be interrupted when we
+       receive a signal, such as SICHLD. This is ok, it will force a
+       refresh. */
+    wait_delay(proc_list, -1);
 
     /* prepare for next select */
     tv.tv_sec = options.delay;
@@ -598,7 +665,6 @@ static int live_mode(struct process_list* proc_list, screen_t* screen)
 {
   WINDOW*         help_win = NULL;
   WINDOW*         error_win = NULL;
-  fd_set          fds;
   struct process** p;
   int             num_iter = 0;
   int             with_colors = 0;
@@ -684,10 +750,6 @@ static int live_mode(struct process_list* proc_list, screen_t* screen)
 
     p = proc_list->proc_ptrs;
 
-    /* prepare for select */
-    FD_ZERO(&fds);
-    FD_SET(STDIN_FILENO, &fds);
-
     /* generate the text version of all rows */
     build_rows(proc_list, screen, COLS - 1);
 
@@ -774,7 +836,7 @@ static int live_mode(struct process_list* proc_list, screen_t* screen)
       compact_proc_list(proc_list);
 
     /* wait some delay, or until a key is pressed */
-    num_fd = select(1 + STDIN_FILENO, &fds, NULL, NULL, &tv);
+    num_fd = wait_delay(proc_list, STDIN_FILENO);
     if (num_fd > 0) {
       int c = handle_key();
       if (c == 'q')
@@ -792,12 +854,12 @@ static int live_mode(struct process_list* proc_list, screen_t* screen)
         header = gen_header(screen, &options, COLS - 1, active_col);
       }
       if (c == 'H') {
-        if (options.show_threads) {
-          reset_values(proc_list);
+        /* counters are attached per thread, or per process: rebuild */
+        if (options.show_threads)
           message = "Show threads On";
-        }
         else
           message = "Show threads Off";
+        return c;
       }
       if (c == 'U') {
         free(header);
@@ -842,14 +904,13 @@ int main(int argc, char* argv[])
   screen_t* screen = NULL;
   int screen_num = 0;
   int q;
+  int papi_init, papi_mux = PAPI_OK;
+
+  /* before the configuration, which names PAPI events */
+  papi_init = PAPI_library_init(PAPI_VER_CURRENT);
+  if (papi_init == PAPI_VER_CURRENT)
+    papi_mux = PAPI_multiplex_init();
 
-  int retval;
-  retval = PAPI_library_init(PAPI_VER_CURRENT);
-  if (retval != PAPI_VER_CURRENT) handle_error(retval);
-  
-  retval = PAPI_multiplex_init();
-  if (retval != PAPI_OK) handle_error(retval);
-  
   /* Check OS to make sure we can run. */
   check();
 
@@ -867,7 +928,19 @@ int main(int argc, char* argv[])
   /* Parse command line arguments. */
   parse_command_line(argc, argv, &options, &list_scr, &screen_num);
 
+  if (options.cgroup && !cgroup_available()) {
+    fprintf(stderr, "cgroup mode requires the unified cgroup hierarchy "
+                    "(cgroup v2).\n");
+    exit(EXIT_FAILURE);
+  }
+
   init_errors(options.batch, options.path_error_file);
+  if (papi_init != PAPI_VER_CURRENT)
+    handle_error(papi_init);
+  else if (papi_mux != PAPI_OK)
+    handle_error(papi_mux);
+
+  pool_init(options.num_jobs);
 
   /* Add default screens */
   if (options.default_screen == 1)
@@ -897,7 +970,7 @@ int main(int argc, char* argv[])
     }
 
     /* initialize the list of processes, and then run */
-    proc_list = init_proc_list();
+    proc_list = init_proc_list(screen, &options);
 
     if (options.spawn_pos) {
       options.spawn_pos = 0;  /* do this only once */
@@ -925,7 +998,7 @@ int main(int argc, char* argv[])
         done_proc_list(proc_list);
         free(header);
       }
-      if ((key == 'u') || (key == 'K') || (key == 'p')) {
+      if ((key == 'u') || (key == 'K') || (key == 'p') || (key == 'H')) {
         done_proc_list(proc_list);
       }
     }
@@ -933,6 +1006,7 @@ int main(int argc, char* argv[])
   } while (key != 'q');
 
   /* done, free memory (makes valgrind happy) */
+  pool_fini();
   close_error();
   delete_screens();
   done_proc_list(proc_list);
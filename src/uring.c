@@ -0,0 +1,322 @@
+/*
+ * This file is part of tiptop.
+ *
+ * Author: Erven ROHOU
+ * Copyright (c) 2012 Inria
+ *
+ * License: GNU General Public License version 2.
+ *
+ */
+
+/* Batched reads with io_uring (--uring). At each refresh, the reads of
+   the stat files, then of the counters, are queued and submitted at
+   once: one io_uring_enter per batch (of up to 'entries' reads)
+   instead of one read per file. The buffers of the tasks can be
+   registered, to save the mapping of the pages at each read.
+
+   The raw system calls are used, no library is needed. When io_uring
+   is not available (old kernel, disabled by the administrator),
+   uring_open fails and the caller keeps reading files one by one. */
+
+#include <config.h>
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "uring.h"
+
+#ifdef HAVE_LINUX_IO_URING_H
+#include <linux/io_uring.h>
+#endif
+
+/* IORING_OP_READ came with the probe (IO_URING_OP_SUPPORTED), in
+   Linux 5.6 */
+#ifdef IO_URING_OP_SUPPORTED
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+/* Older headers do not define them. */
+#ifndef __NR_io_uring_setup
+#define __NR_io_uring_setup    425
+#define __NR_io_uring_enter    426
+#define __NR_io_uring_register 427
+#endif
+
+struct uring {
+  int       fd;
+  unsigned int entries;
+  unsigned int queued;    /* in the submission queue, not submitted */
+  unsigned int inflight;  /* queued or submitted, not completed */
+  unsigned long num_syscalls;
+  int       failed;       /* see uring_wait */
+
+  /* submission queue */
+  unsigned int* sq_head;
+  unsigned int* sq_tail;
+  unsigned int* sq_mask;
+  unsigned int* sq_array;
+  struct io_uring_sqe* sqes;
+
+  /* completion queue */
+  unsigned int* cq_head;
+  unsigned int* cq_tail;
+  unsigned int* cq_mask;
+  struct io_uring_cqe* cqes;
+
+  void*  sq_ptr;
+  size_t sq_size;
+  void*  cq_ptr;
+  size_t cq_size;
+  size_t sqes_size;
+
+  char*  buf;  /* registered buffer, NULL if none */
+  size_t buf_size;
+};
+
+
+/* Does the kernel support IORING_OP_READ? */
+static int has_read_op(int fd)
+{
+  const int num_ops = 64;
+  struct io_uring_probe* probe;
+  int ok;
+
+  probe = calloc(1, sizeof(struct io_uring_probe) +
+                 num_ops * sizeof(struct io_uring_probe_op));
+  ok = (syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE,
+                probe, num_ops) == 0) &&
+       (probe->last_op >= IORING_OP_READ) &&
+       (probe->ops[IORING_OP_READ].flags & IO_URING_OP_SUPPORTED);
+  free(probe);
+  return ok;
+}
+
+
+/* Set up a ring of (about) 'entries' reads. Return NULL if io_uring
+   is not available. */
+struct uring* uring_open(unsigned int entries)
+{
+  struct io_uring_params params;
+  struct uring* r;
+  char* sq;
+  char* cq;
+
+  memset(&params, 0, sizeof(params));
+  r = calloc(1, sizeof(struct uring));
+  r->fd = syscall(__NR_io_uring_setup, entries, &params);
+  if (r->fd == -1) {
+    free(r);
+    return NULL;
+  }
+  if (!has_read_op(r->fd)) {
+    close(r->fd);
+    free(r);
+    return NULL;
+  }
+  r->entries = params.sq_entries;
+
+  r->sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+  r->cq_size = params.cq_off.cqes +
+               params.cq_entries * sizeof(struct io_uring_cqe);
+  r->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+
+  r->sq_ptr = mmap(NULL, r->sq_size, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+  r->cq_ptr = mmap(NULL, r->cq_size, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+  r->sqes = mmap(NULL, r->sqes_size, PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+  if ((r->sq_ptr == MAP_FAILED) || (r->cq_ptr == MAP_FAILED) ||
+      (r->sqes == MAP_FAILED)) {
+    if (r->sq_ptr != MAP_FAILED)
+      munmap(r->sq_ptr, r->sq_size);
+    if (r->cq_ptr != MAP_FAILED)
+      munmap(r->cq_ptr, r->cq_size);
+    if (r->sqes != MAP_FAILED)
+      munmap(r->sqes, r->sqes_size);
+    close(r->fd);
+    free(r);
+    return NULL;
+  }
+
+  sq = r->sq_ptr;
+  r->sq_head = (unsigned int*)(sq + params.sq_off.head);
+  r->sq_tail = (unsigned int*)(sq + params.sq_off.tail);
+  r->sq_mask = (unsigned int*)(sq + params.sq_off.ring_mask);
+  r->sq_array = (unsigned int*)(sq + params.sq_off.array);
+
+  cq = r->cq_ptr;
+  r->cq_head = (unsigned int*)(cq + params.cq_off.head);
+  r->cq_tail = (unsigned int*)(cq + params.cq_off.tail);
+  r->cq_mask = (unsigned int*)(cq + params.cq_off.ring_mask);
+  r->cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+  return r;
+}
+
+
+void uring_close(struct uring* r)
+{
+  if (!r)
+    return;
+  munmap(r->sq_ptr, r->sq_size);
+  munmap(r->cq_ptr, r->cq_size);
+  munmap(r->sqes, r->sqes_size);
+  close(r->fd);
+  free(r);
+}
+
+
+/* Register the area where the reads go (one at a time, a new one
+   replaces the previous one). Return -1 if it cannot be registered
+   (e.g. beyond RLIMIT_MEMLOCK): reads into it still work, the pages
+   are simply mapped at each read. */
+int uring_register_buffer(struct uring* r, void* buf, size_t size)
+{
+  struct iovec iov;
+
+  if (r->buf) {
+    syscall(__NR_io_uring_register, r->fd, IORING_UNREGISTER_BUFFERS,
+            NULL, 0);
+    r->buf = NULL;
+  }
+
+  iov.iov_base = buf;
+  iov.iov_len = size;
+  if (syscall(__NR_io_uring_register, r->fd, IORING_REGISTER_BUFFERS,
+              &iov, 1) == -1)
+    return -1;
+  r->buf = buf;
+  r->buf_size = size;
+  return 0;
+}
+
+
+/* Move the completions to the results of the reads. */
+static void reap(struct uring* r)
+{
+  unsigned int head = *r->cq_head;
+  unsigned int tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+
+  while (head != tail) {
+    const struct io_uring_cqe* const cqe = &r->cqes[head & *r->cq_mask];
+    *(int*)(uintptr_t)cqe->user_data = cqe->res;
+    head++;
+    r->inflight--;
+  }
+  __atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+}
+
+
+/* Submit the queued reads, and wait for all of them. Return -1 if the
+   ring failed: the reads not completed keep URING_PENDING, and the
+   ring takes no more reads. The reads submitted may still complete,
+   so the ring must be closed, and their buffers kept meanwhile. */
+int uring_wait(struct uring* r)
+{
+  if (r->failed)
+    return -1;
+  while (r->inflight) {
+    int n = syscall(__NR_io_uring_enter, r->fd, r->queued, r->inflight,
+                    IORING_ENTER_GETEVENTS, NULL, 0);
+    r->num_syscalls++;
+    if (n == -1) {
+      if (errno == EINTR)
+        continue;
+      r->failed = 1;
+      return -1;
+    }
+    r->queued -= n;
+    reap(r);
+  }
+  return 0;
+}
+
+
+/* Queue the read of 'len' bytes of file 'fd' (from the start) into
+   'buf'. The number of bytes read, or -errno, is stored in 'res' by
+   uring_wait. The queue is submitted when full. */
+void uring_read(struct uring* r, int fd, void* buf, unsigned int len,
+                int* res)
+{
+  struct io_uring_sqe* sqe;
+  unsigned int tail, idx;
+
+  *res = URING_PENDING;
+  if (r->failed)
+    return;
+  if (r->inflight == r->entries) {
+    if (uring_wait(r) == -1)
+      return;
+  }
+
+  tail = *r->sq_tail;
+  idx = tail & *r->sq_mask;
+  sqe = &r->sqes[idx];
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->fd = fd;
+  sqe->off = 0;
+  sqe->addr = (uintptr_t)buf;
+  sqe->len = len;
+  sqe->user_data = (uintptr_t)res;
+  if (r->buf && ((char*)buf >= r->buf) &&
+      ((char*)buf + len <= r->buf + r->buf_size)) {
+    sqe->opcode = IORING_OP_READ_FIXED;
+    sqe->buf_index = 0;
+  }
+  else
+    sqe->opcode = IORING_OP_READ;
+  r->sq_array[idx] = idx;
+  __atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+  r->queued++;
+  r->inflight++;
+}
+
+
+unsigned long uring_num_syscalls(const struct uring* r)
+{
+  return r->num_syscalls;
+}
+
+#else  /* IO_URING_OP_SUPPORTED */
+
+struct uring* uring_open(unsigned int entries)
+{
+  return NULL;
+}
+
+
+void uring_close(struct uring* r)
+{
+}
+
+
+int uring_register_buffer(struct uring* r, void* buf, size_t size)
+{
+  return -1;
+}
+
+
+void uring_read(struct uring* r, int fd, void* buf, unsigned int len,
+                int* res)
+{
+  *res = URING_PENDING;
+}
+
+
+int uring_wait(struct uring* r)
+{
+  return -1;
+}
+
+
+unsigned long uring_num_syscalls(const struct uring* r)
+{
+  return 0;
+}
+
+#endif  /* IO_URING_OP_SUPPORTED */
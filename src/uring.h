@@ -0,0 +1,30 @@
+/*
+ * This file is part of tiptop.
+ *
+ * Author: Erven ROHOU
+ * Copyright (c) 2012 Inria
+ *
+ * License: GNU General Public License version 2.
+ *
+ */
+
+#ifndef _URING_H
+#define _URING_H
+
+#include <limits.h>
+#include <stddef.h>
+
+/* Result of a read not completed (yet): the caller reads by itself. */
+#define URING_PENDING INT_MIN
+
+struct uring;
+
+struct uring* uring_open(unsigned int entries);
+void uring_close(struct uring* ring);
+int  uring_register_buffer(struct uring* ring, void* buf, size_t size);
+void uring_read(struct uring* ring, int fd, void* buf, unsigned int len,
+                int* res);
+int  uring_wait(struct uring* ring);
+unsigned long uring_num_syscalls(const struct uring* ring);
+
+#endif  /* _URING_H */
@@ -0,0 +1,103 @@
+/*
+ * This file is part of tiptop.
+ *
+ * Author: Erven ROHOU
+ * Copyright (c) 2012 Inria
+ *
+ * License: GNU General Public License version 2.
+ *
+ */
+
+/* Cache of user names. getpwuid can be slow (NSS backed by LDAP or
+   SSSD), and all the threads of a process have the same owner: the
+   name is looked up once per uid. Entries are never freed nor moved,
+   so that tasks can keep a pointer to the name. When /etc/passwd
+   changes, names are looked up again and updated in place. */
+
+#include <pwd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "users.h"
+
+struct user_entry {
+  uid_t  uid;
+  int    stale;
+  char   name[USER_NAME_LEN];
+};
+
+static struct user_entry** users = NULL;  /* sorted by uid */
+static int    num_users = 0;
+static int    num_alloc_users = 0;
+static time_t passwd_mtime = 0;
+
+
+static void lookup(struct user_entry* const u)
+{
+  struct passwd* passwd = getpwuid(u->uid);
+
+  if (passwd)
+    snprintf(u->name, sizeof(u->name), "%s", passwd->pw_name);
+  else  /* unknown user, show the uid */
+    snprintf(u->name, sizeof(u->name), "%d", (int)u->uid);
+  u->stale = 0;
+}
+
+
+/* Invalidate the names if the password file changed. Called once per
+   refresh. */
+void users_check()
+{
+  struct stat st;
+  int i;
+
+  if (stat("/etc/passwd", &st) == -1)
+    return;
+  if (st.st_mtime == passwd_mtime)
+    return;
+  passwd_mtime = st.st_mtime;
+  for(i = 0; i < num_users; i++)
+    users[i]->stale = 1;
+}
+
+
+/* Return the name of the user 'uid'. The string remains valid for the
+   lifetime of tiptop. */
+const char* user_name(uid_t uid)
+{
+  struct user_entry* u;
+  int lo = 0, hi = num_users;
+
+  while (lo < hi) {
+    const int mid = (lo + hi) / 2;
+    if (users[mid]->uid < uid)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  if ((lo < num_users) && (users[lo]->uid == uid)) {
+    u = users[lo];
+    if (u->stale)
+      lookup(u);
+    return u->name;
+  }
+
+  /* new uid, insert at position lo */
+  if (num_users == num_alloc_users) {
+    num_alloc_users = num_alloc_users ? 2 * num_alloc_users : 16;
+    users = realloc(users, num_alloc_users * sizeof(struct user_entry*));
+  }
+  memmove(&users[lo + 1], &users[lo],
+          (num_users - lo) * sizeof(struct user_entry*));
+  num_users++;
+
+  u = malloc(sizeof(struct user_entry));
+  u->uid = uid;
+  lookup(u);
+  users[lo] = u;
+  return u->name;
+}
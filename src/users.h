@@ -0,0 +1,21 @@
+/*
+ * This file is part of tiptop.
+ *
+ * Author: Erven ROHOU
+ * Copyright (c) 2012 Inria
+ *
+ * License: GNU General Public License version 2.
+ *
+ */
+
+#ifndef _USERS_H
+#define _USERS_H
+
+#include <sys/types.h>
+
+#define USER_NAME_LEN 33
+
+void users_check(void);
+const char* user_name(uid_t uid);
+
+#endif  /* _USERS_H */
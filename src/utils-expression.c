@@ -13,7 +13,6 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <papi.h>
 
 #include "formula-parser.h"
 #include "process.h"
@@ -206,161 +205,349 @@ static int get_counter_id(char* alias, counter_t* tab, int nbc)
 }
 
 
-/* Tools to get counter value */
-static double get_counter_value(unit* e, counter_t* tab, int nbc, char delta,
-                                struct process* p, int* error)
+/* Append an instruction to the program. */
+static void emit(program_t* prog, int opcode, int arg, double val)
 {
-  int id;
-  /* System information: not based on performances counters */
-  if (strcmp(e->alias, "CPU_TOT") == 0)
-    return p->cpu_percent;
-
-  if (strcmp(e->alias, "CPU_SYS") == 0)
-    return p->cpu_percent_s;
-
-  if (strcmp(e->alias, "CPU_USER") == 0)
-    return p->cpu_percent_u;
-
-  if (strcmp(e->alias, "NUM_THREADS") == 0)
-    return p->num_threads;
-
-  int EventCode = PAPI_NULL;
-  if (PAPI_event_name_to_code(e->alias,&EventCode) == PAPI_OK) {
-    double retval;
-    
-    int retcode;
-    PAPI_option_t options;
-
-    int i = 0;
-    do {
-        options.attach.eventset = i;
-        retcode = PAPI_get_opt(PAPI_ATTACH, &options);
-        if (retcode<0) {
-            handle_error(retcode);
-            *error=1;
-            return 1;
-        }
-        if (options.attach.tid == p->tid) break;
-        i++;
-    } while (1);
-
-    long long values[PAPI_num_events(options.attach.eventset)];
-    for (i=0;i<PAPI_num_events(options.attach.eventset);i++)
-        values[i] = (long long)0;
-
-    int k = 0;
-    for (i=0;i<MAX_EVENTS;i++) {
-        if (p->papi[i]==EventCode) {
-            k = i;
-            break;
-        }
-    }
+  prog->instrs = realloc(prog->instrs,
+                         (prog->num_instrs + 1) * sizeof(instr_t));
+  prog->instrs[prog->num_instrs].opcode = opcode;
+  prog->instrs[prog->num_instrs].arg = arg;
+  prog->instrs[prog->num_instrs].val = val;
+  prog->num_instrs++;
+}
 
-    int numPapiEvents = 0;
-    for (i=0;i<MAX_EVENTS;i++) {
-        if (p->papi[i]==-1) {
-            numPapiEvents = i;
-            break;
-        }
-    }    
-
-    if (k==(numPapiEvents-1)) {
-        retcode = PAPI_accum( options.attach.eventset, values );
-        if (retcode!=PAPI_OK) handle_error(retcode);
-    } else {
-        retcode = PAPI_read( options.attach.eventset, values );
-        if (retcode!=PAPI_OK) handle_error(retcode);
+
+/* Resolve the name of an operand, in the order builtins, counters of
+   the screen (PAPI events included). Return the stack depth (1), -1 if unknown. */
+static int compile_operand(program_t* prog, unit* u, counter_t* tab, int nbc)
+{
+  static const struct {
+    const char* name;
+    int         opcode;
+  } builtins[] = {
+    { "CPU_TOT", I_CPU_TOT },
+    { "CPU_SYS", I_CPU_SYS },
+    { "CPU_USER", I_CPU_USER },
+    { "NUM_THREADS", I_NUM_THREADS },
+    { "MUX_RATIO", I_MUX_RATIO },
+    { "PROC_ID", I_PROC_ID }
+  };
+  int i;
+
+  for(i = 0; i < (int)(sizeof(builtins) / sizeof(builtins[0])); i++) {
+    if (strcmp(u->alias, builtins[i].name) == 0) {
+      emit(prog, builtins[i].opcode, 0, 0);
+      return 1;
     }
-    
-    return (double)(values[k]);
   }
 
-  if (strcmp(e->alias, "PROC_ID") == 0) {
-    if (p->proc_id != -1) {
-      return (double)p->proc_id;
-    }
-    else {
-      *error=1;
+  i = get_counter_id(u->alias, tab, nbc);
+  if (i == -1)
+    return -1;
+  emit(prog, (u->delta == DELT) ? I_DELTA : I_COUNTER, i, 0);
+  return 1;
+}
+
+
+/* Emit the postfix code of 'e'. Operations on two constants are
+   folded. Return the stack depth needed, -1 on error. */
+static int compile_node(program_t* prog, expression* e,
+                        counter_t* tab, int nbc)
+{
+  int d1, d2, opcode;
+  instr_t* a;
+
+  if (e == NULL)
+    return -1;
+
+  if (e->type == ELEM) {
+    if (e->ele->type == COUNT)
+      return compile_operand(prog, e->ele, tab, nbc);
+    if (e->ele->type == CONST) {
+      emit(prog, I_CONST, 0, e->ele->val);
       return 1;
     }
+    return -1;
   }
 
-  if (strcmp(e->alias, "NUM_THREADS") == 0)
-    return p->num_threads;
+  if ((e->type != OPER) || (e->op == NULL))
+    return -1;
 
-  id = get_counter_id(e->alias, tab, nbc);
+  switch(e->op->operator) {
+  case '+': opcode = I_ADD; break;
+  case '-': opcode = I_SUB; break;
+  case '*': opcode = I_MUL; break;
+  case '/': opcode = I_DIV; break;
+  default:  return -1;  /* not for columns (shifts and masks) */
+  }
 
-  if ((id == -1) || (p->values[id] == 0xffffffff)) {
-    /* Invalid counter */
-    *error = 1;
+  d1 = compile_node(prog, e->op->exp1, tab, nbc);
+  if (d1 < 0)
+    return -1;
+  d2 = compile_node(prog, e->op->exp2, tab, nbc);
+  if (d2 < 0)
+    return -1;
+
+  /* both operands constant: compute now, unless divide by zero */
+  a = &prog->instrs[prog->num_instrs - 2];
+  if ((d1 == 1) && (d2 == 1) && (a[0].opcode == I_CONST) &&
+      (a[1].opcode == I_CONST) && ((opcode != I_DIV) || (a[1].val != 0))) {
+    switch(opcode) {
+    case I_ADD: a[0].val += a[1].val; break;
+    case I_SUB: a[0].val -= a[1].val; break;
+    case I_MUL: a[0].val *= a[1].val; break;
+    case I_DIV: a[0].val /= a[1].val; break;
+    }
+    prog->num_instrs--;
     return 1;
   }
 
-  if (delta == DELT)
-    return (double) (p->values[id] - p->prev_values[id]);
+  emit(prog, opcode, 0, 0);
+  return (d1 > d2 + 1) ? d1 : d2 + 1;
+}
+
+
+/* Translate the expression of a column into a program. Counters are
+   referred to by their index in 'tab'. Return NULL if the expression
+   cannot be evaluated. */
+program_t* compile_expression(expression* e, counter_t* tab, int nbc)
+{
+  program_t* prog = malloc(sizeof(program_t));
 
-  return (double) p->values[id];
+  prog->num_instrs = 0;
+  prog->instrs = NULL;
+  if (compile_node(prog, e, tab, nbc) < 0) {
+    free_program(prog);
+    return NULL;
+  }
+  return prog;
 }
 
 
-/* Calculous and return result of expression gived in entry
- *
- * (argument error is used for indicate and determine which kind of
- * error appear during evaulation:
- *      1 => Invalid Counter
- *      2 => Divide per zero (also if it is double)
- */
+void free_program(program_t* prog)
+{
+  if (prog == NULL)
+    return;
+  free(prog->instrs);
+  free(prog);
+}
 
 
-double evaluate_column_expression(expression* e, counter_t* c, int nbc,
-                           struct process* p, int* error)
+/* Return the node (opcode, arg, val, left, right) of the DAG, added if
+   not already there. */
+static int find_node(dag_t* dag, int opcode, int arg, double val,
+                     int left, int right)
 {
-  /* Invalid Expression */
-  if (e == NULL) {
-    *error = 1;
-    return 0;
+  node_t* n;
+  int i;
+
+  /* commutative operators: one order only */
+  if (((opcode == I_ADD) || (opcode == I_MUL)) && (left > right)) {
+    const int tmp = left;
+    left = right;
+    right = tmp;
   }
-  *error = 0;
-  if (e->type == ELEM) {
-    /* Return Element value */
-    if (e->ele->type == COUNT)
-      return get_counter_value(e->ele, c, nbc, e->ele->delta, p, error);
-    else if(e->ele->type == CONST)
-      return e->ele->val;
+
+  for(i = 0; i < dag->num_nodes; i++) {
+    n = &dag->nodes[i];
+    if ((n->opcode == opcode) && (n->arg == arg) && (n->val == val) &&
+        (n->left == left) && (n->right == right))
+      return i;
   }
-  else if ((e->type == OPER) && (e->op != NULL)) {
-    /* Or calcul leaf value and return the result */
-    switch(e->op->operator) {
-    case '+':
-      return evaluate_column_expression(e->op->exp1, c, nbc, p, error) +
-             evaluate_column_expression(e->op->exp2, c, nbc, p, error);
-      break;
 
-    case '-':
-      return evaluate_column_expression(e->op->exp1, c, nbc, p, error) -
-             evaluate_column_expression(e->op->exp2, c, nbc, p, error);
+  dag->nodes = realloc(dag->nodes, (dag->num_nodes + 1) * sizeof(node_t));
+  n = &dag->nodes[dag->num_nodes];
+  n->opcode = opcode;
+  n->arg = arg;
+  n->val = val;
+  n->left = left;
+  n->right = right;
+  return dag->num_nodes++;
+}
+
+
+/* Merge the program of a column into the DAG of the screen. Return the
+   node of the result of the column. */
+int dag_add_program(dag_t* dag, const program_t* prog)
+{
+  int stack[prog->num_instrs];
+  int sp = 0, pc;
+
+  for(pc = 0; pc < prog->num_instrs; pc++) {
+    const instr_t* const in = &prog->instrs[pc];
+    switch(in->opcode) {
+    case I_ADD:
+    case I_SUB:
+    case I_MUL:
+    case I_DIV:
+      sp -= 2;
+      stack[sp] = find_node(dag, in->opcode, 0, 0, stack[sp], stack[sp + 1]);
       break;
+    default:
+      stack[sp] = find_node(dag, in->opcode, in->arg, in->val, -1, -1);
+    }
+    sp++;
+  }
+  assert(sp == 1);
+  return stack[0];
+}
+
+
+void free_dag(dag_t* dag)
+{
+  free(dag->nodes);
+  dag->nodes = NULL;
+  dag->num_nodes = 0;
+}
+
 
-    case '*':
-      return evaluate_column_expression(e->op->exp1, c, nbc, p, error) *
-             evaluate_column_expression(e->op->exp2, c, nbc, p, error);
+/* Counter 'id' (unused by the columns) is removed from the screen:
+   the following ones move down. */
+void dag_remove_counter(dag_t* dag, int id)
+{
+  int i;
+  for(i = 0; i < dag->num_nodes; i++) {
+    node_t* const n = &dag->nodes[i];
+    if (((n->opcode == I_COUNTER) || (n->opcode == I_DELTA)) && (n->arg > id))
+      n->arg--;
+  }
+}
+
+
+/* Compute all the nodes of the screen for 'num' tasks at once: each
+ * node is a loop over the tasks, that the compiler can vectorize. The
+ * value of node k for task i goes to res[k * num + i]. 'slots' are the
+ * slots of the tasks in the counter columns.
+ *
+ * Errors are tracked per task in 'err' (same layout as 'res'), which
+ * receives:
+ *      0 => valid result
+ *      1 => Invalid Counter (takes precedence)
+ *      2 => Divide per zero
+ * The value of a task in error is 0.
+ */
+void evaluate_dag(const dag_t* dag, const struct process_list* list,
+                  struct process* const* tasks, const int* slots, int num,
+                  double* res, char* err)
+{
+  const struct counter_columns* const c = &list->columns;
+  int k, i;
+
+  for(k = 0; k < dag->num_nodes; k++) {
+    const node_t* const n = &dag->nodes[k];
+    double* const out = res + k * num;
+    char*   const e = err + k * num;
+
+    switch(n->opcode) {
+    case I_CONST:
+      for(i = 0; i < num; i++) {
+        out[i] = n->val;
+        e[i] = 0;
+      }
       break;
-    case '/': {
-      double tmp = evaluate_column_expression(e->op->exp2, c, nbc, p, error);
-      if (tmp == 0) {
-        /* Divide by 0 */
-        *error = 2;
-        return 0;
+    case I_COUNTER: {
+      const uint64_t* const val = c->values[n->arg];
+      for(i = 0; i < num; i++) {
+        const uint64_t v = val[slots[i]];
+        const int bad = (v == 0xffffffff);
+        e[i] = bad;
+        out[i] = bad ? 0 : (double)v;
       }
-      return evaluate_column_expression(e->op->exp1, c, nbc, p, error) / tmp;
       break;
     }
-    default:
-      /* Unknown operator */
-      assert(0);
+    case I_DELTA: {
+      const uint64_t* const val = c->values[n->arg];
+      const uint64_t* const prev = c->prev_values[n->arg];
+      for(i = 0; i < num; i++) {
+        const int s = slots[i];
+        const int bad = (val[s] == 0xffffffff);
+        e[i] = bad;
+        out[i] = bad ? 0 : (double)(val[s] - prev[s]);
+      }
+      break;
+    }
+    case I_CPU_TOT:
+      for(i = 0; i < num; i++) {
+        out[i] = tasks[i]->cpu_percent;
+        e[i] = 0;
+      }
+      break;
+    case I_CPU_SYS:
+      for(i = 0; i < num; i++) {
+        out[i] = tasks[i]->cpu_percent_s;
+        e[i] = 0;
+      }
+      break;
+    case I_CPU_USER:
+      for(i = 0; i < num; i++) {
+        out[i] = tasks[i]->cpu_percent_u;
+        e[i] = 0;
+      }
+      break;
+    case I_NUM_THREADS:
+      for(i = 0; i < num; i++) {
+        out[i] = tasks[i]->num_threads;
+        e[i] = 0;
+      }
+      break;
+    case I_MUX_RATIO:
+      for(i = 0; i < num; i++) {
+        out[i] = tasks[i]->mux_ratio;
+        e[i] = 0;
+      }
+      break;
+    case I_PROC_ID:
+      for(i = 0; i < num; i++) {
+        e[i] = (tasks[i]->proc_id == -1);
+        out[i] = tasks[i]->proc_id;
+      }
+      break;
+
+    default: {  /* binary operators */
+      const double* const a = res + n->left * num;
+      const double* const b = res + n->right * num;
+      const char* const ea = err + n->left * num;
+      const char* const eb = err + n->right * num;
+      switch(n->opcode) {
+      case I_ADD:
+        for(i = 0; i < num; i++) {
+          out[i] = a[i] + b[i];
+          e[i] = ea[i] | eb[i];
+        }
+        break;
+      case I_SUB:
+        for(i = 0; i < num; i++) {
+          out[i] = a[i] - b[i];
+          e[i] = ea[i] | eb[i];
+        }
+        break;
+      case I_MUL:
+        for(i = 0; i < num; i++) {
+          out[i] = a[i] * b[i];
+          e[i] = ea[i] | eb[i];
+        }
+        break;
+      case I_DIV:
+        for(i = 0; i < num; i++) {
+          const int zero = (b[i] == 0);
+          out[i] = zero ? 0 : a[i] / b[i];
+          e[i] = ea[i] | eb[i] | (zero << 1);
+        }
+        break;
+      default:
+        assert(0);
+      }
+    }
+    }
+  }
+
+  /* all nodes are computed, turn the masks into error codes */
+  for(i = 0; i < dag->num_nodes * num; i++) {
+    if (err[i]) {
+      err[i] = (err[i] & 1) ? 1 : 2;
+      res[i] = 0;
     }
   }
-  return 0;
 }
 
 uint64_t evaluate_counter_expression(expression* e, int* error)
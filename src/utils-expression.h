@@ -32,8 +32,14 @@ int build_expression(expression* e, FILE* fd);
 
 expression* parser_expression (char* txt);
 
-double evaluate_column_expression(expression* e, counter_t* c, int nbc,
-                           struct process* p, int* error);
+program_t* compile_expression(expression* e, counter_t* tab, int nbc);
+void free_program(program_t* prog);
+int  dag_add_program(dag_t* dag, const program_t* prog);
+void dag_remove_counter(dag_t* dag, int id);
+void free_dag(dag_t* dag);
+void evaluate_dag(const dag_t* dag, const struct process_list* list,
+                  struct process* const* tasks, const int* slots, int num,
+                  double* res, char* err);
 uint64_t evaluate_counter_expression(expression* e, int* error);
 
 #endif  /* _UTILS_EXPRESSION_H */
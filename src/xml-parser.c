@@ -47,6 +47,12 @@ static void option_update(xmlChar* name, xmlChar* val, struct option* opt)
   if(!xmlStrcmp(name, (const xmlChar *) "cpu_threshold")) {
     opt->cpu_threshold = (float)atof((char*)val);
   }
+  if(!xmlStrcmp(name, (const xmlChar *) "num_jobs")) {
+    opt->num_jobs = atoi((const char*)val);
+  }
+  if(!xmlStrcmp(name, (const xmlChar *) "release_delay")) {
+    opt->release_delay = (float)atof((const char*)val);
+  }
   if(!xmlStrcmp(name, (xmlChar *) "batch")) {
     opt->batch = (opt->batch || atoi((char*)val));
   }
@@ -80,6 +86,18 @@ static void option_update(xmlChar* name, xmlChar* val, struct option* opt)
   if(!xmlStrcmp(name, (xmlChar *) "show_threads")) {
     opt->show_threads = atoi((char*)val);
   }
+  if(!xmlStrcmp(name, (const xmlChar *) "netlink"))
+    opt->netlink = atoi((const char*)val);
+
+  if(!xmlStrcmp(name, (const xmlChar *) "uring"))
+    opt->uring = atoi((const char*)val);
+
+  if(!xmlStrcmp(name, (const xmlChar *) "exits"))
+    opt->exits = atoi((const char*)val);
+
+  if(!xmlStrcmp(name, (const xmlChar *) "cgroup"))
+    opt->cgroup = atoi((const char*)val);
+
   if(!xmlStrcmp(name, (const xmlChar *) "idle"))
     opt->idle = atoi((const char*)val);
 
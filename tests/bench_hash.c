@@ -0,0 +1,175 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "hash.h"
+
+/* Micro-benchmark of the tid hash table: insert, lookup (present and
+   absent keys) and delete of N tasks, with the former chained table
+   (16 buckets) and with hash.c. Keys mimic tids: mostly consecutive
+   runs (threads of one process), with gaps. Results of both tables
+   are checked against each other.
+
+   gcc -O2 -I../src -I<build dir> bench_hash.c ../src/hash.c -o bench_hash
+   (hash.c includes config.h, generated by configure)
+   ./bench_hash [iterations]
+*/
+
+#define OLD_NUM_HASH_KEYS 16
+
+struct old_entry {
+  struct process* data;
+  struct old_entry* next;
+};
+
+static struct old_entry* old_map[OLD_NUM_HASH_KEYS];
+
+
+/* The code formerly in hash.c */
+static void old_add(int key, struct process* proc)
+{
+  struct old_entry* new;
+  int h = key & (OLD_NUM_HASH_KEYS - 1);
+  struct old_entry* ptr = old_map[h];
+
+  while (ptr) {
+    if (ptr->data->tid == key)
+      return;
+    ptr = ptr->next;
+  }
+  new = malloc(sizeof(struct old_entry));
+  new->data = proc;
+  new->next = old_map[h];
+  old_map[h] = new;
+}
+
+static struct process* old_get(int key)
+{
+  struct old_entry* ptr = old_map[key & (OLD_NUM_HASH_KEYS - 1)];
+
+  while (ptr) {
+    if (ptr->data->tid == key)
+      return ptr->data;
+    ptr = ptr->next;
+  }
+  return NULL;
+}
+
+static void old_del(int key)
+{
+  struct old_entry** prev = &old_map[key & (OLD_NUM_HASH_KEYS - 1)];
+
+  while ((*prev)->data->tid != key)
+    prev = &(*prev)->next;
+  {
+    struct old_entry* to_delete = *prev;
+    *prev = to_delete->next;
+    free(to_delete);
+  }
+}
+
+
+static double now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+static void run(int n, int iter)
+{
+  struct process* procs = calloc(n, sizeof(struct process));
+  double t0, t_old[3] = { 0 }, t_new[3] = { 0 };
+  long found_old = 0, found_new = 0;
+  int i, it, tid = 300;
+
+  for(i = 0; i < n; i++) {
+    if (rand() % 8 == 0)  /* new process, leave a gap */
+      tid += 1 + rand() % 50;
+    procs[i].tid = tid++;
+  }
+
+  for(it = 0; it < iter; it++) {
+    /* old */
+    t0 = now();
+    for(i = 0; i < n; i++)
+      old_add(procs[i].tid, &procs[i]);
+    t_old[0] += now() - t0;
+    t0 = now();
+    for(i = 0; i < 2 * n; i++)
+      found_old += (old_get(procs[i % n].tid + (i >= n)) != NULL);
+    t_old[1] += now() - t0;
+    t0 = now();
+    for(i = 0; i < n; i++)
+      old_del(procs[i].tid);
+    t_old[2] += now() - t0;
+
+    /* new */
+    hash_init();
+    t0 = now();
+    for(i = 0; i < n; i++)
+      hash_add(procs[i].tid, &procs[i]);
+    t_new[0] += now() - t0;
+    t0 = now();
+    for(i = 0; i < 2 * n; i++)
+      found_new += (hash_get(procs[i % n].tid + (i >= n)) != NULL);
+    t_new[1] += now() - t0;
+    t0 = now();
+    for(i = 0; i < n; i++)
+      hash_del(procs[i].tid, &procs[i]);
+    t_new[2] += now() - t0;
+    for(i = 0; i < n; i++)
+      assert(hash_get(procs[i].tid) == NULL);
+    hash_fini();
+  }
+  assert(found_old == found_new);
+
+  printf("%7d tids   insert %8.1f ns  %6.1f ns   lookup %8.1f ns  %6.1f ns"
+         "   delete %8.1f ns  %6.1f ns\n", n,
+         1e9 * t_old[0] / ((double)n * iter), 1e9 * t_new[0] / ((double)n * iter),
+         1e9 * t_old[1] / (2.0 * n * iter), 1e9 * t_new[1] / (2.0 * n * iter),
+         1e9 * t_old[2] / ((double)n * iter), 1e9 * t_new[2] / ((double)n * iter));
+  free(procs);
+}
+
+
+/* Random inserts and deletes, checked against a plain array. Deletes
+   of an entry on behalf of another process are ignored. */
+static void check()
+{
+  enum { N = 5000 };
+  static struct process procs[N];
+  static int present[N];
+  int i;
+
+  hash_init();
+  for(i = 0; i < N; i++)
+    procs[i].tid = 1 + (i * 7) % 20000;
+  for(i = 0; i < 200000; i++) {
+    int k = rand() % N;
+    hash_del(procs[k].tid, &procs[(k + 1) % N]);  /* not its entry: no-op */
+    if (present[k])
+      hash_del(procs[k].tid, &procs[k]);
+    else
+      hash_add(procs[k].tid, &procs[k]);
+    present[k] = !present[k];
+  }
+  for(i = 0; i < N; i++)
+    assert(hash_get(procs[i].tid) == (present[i] ? &procs[i] : NULL));
+  hash_fini();
+}
+
+
+int main(int argc, char* argv[])
+{
+  int iter = (argc > 1) ? atoi(argv[1]) : 3;
+
+  check();
+  printf("%13s  %s\n", "", "(per operation: former table, hash.c)");
+  run(1000, 20 * iter);
+  run(10000, 2 * iter);
+  run(100000, 1);
+  return 0;
+}
@@ -0,0 +1,121 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "task-stat.h"
+
+/* Micro-benchmark: parse of /proc/PID/task/TID/stat lines, with the
+   former pair of fscanf (one FILE per line, as in fopen + fscanf) and
+   with parse_task_stat. Lines are read from a corpus of captured stat
+   files, one per line (see stat-corpus.txt).
+
+   gcc -O2 -I../src bench_stat_parser.c ../src/task-stat.c -o bench_stat_parser
+   ./bench_stat_parser stat-corpus.txt [iterations]
+*/
+
+#define MAX_LINES 1024
+
+static char* lines[MAX_LINES];
+static int   lens[MAX_LINES];
+static int   num_lines;
+
+
+static double now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+/* The code formerly in update_proc_list */
+static int parse_fscanf(char* buf, int len, struct task_stat* st)
+{
+  FILE* f = fmemopen(buf, len, "r");
+  int   n, proc_id;
+  char  state = ' ';
+  unsigned long utime, stime;
+
+  n = fscanf(f, "%*d (%*[^)]) %c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu",
+             &state, &utime, &stime);
+  if (n != 3)
+    utime = stime = 0;
+  n = fscanf(f, "%*d %*d %*d %*d %*d %*d %*d %*u %*d %*u %*u %*u %*u "
+             "%*u %*u %*u %*u %*u %*u %*u %*u %*u %*d %d", &proc_id);
+  if (n != 1)
+    proc_id = -1;
+  fclose(f);
+
+  st->state = state;
+  st->utime = utime;
+  st->stime = stime;
+  st->processor = proc_id;
+  return 0;
+}
+
+
+int main(int argc, char* argv[])
+{
+  FILE*  f;
+  char   line[1024];
+  int    i, j, iter = 100000, mismatch = 0;
+  double t0, t_scanf, t_parse;
+  struct task_stat st1, st2;
+  unsigned long sum = 0;
+
+  if (argc < 2) {
+    fprintf(stderr, "Usage: %s corpus [iterations]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+  if (argc > 2)
+    iter = atoi(argv[2]);
+
+  f = fopen(argv[1], "r");
+  if (!f) {
+    perror("fopen");
+    return EXIT_FAILURE;
+  }
+  while ((num_lines < MAX_LINES) && fgets(line, sizeof(line), f)) {
+    lines[num_lines] = strdup(line);
+    lens[num_lines] = strlen(line);
+    num_lines++;
+  }
+  fclose(f);
+
+  /* compare results */
+  for(i=0; i < num_lines; i++) {
+    parse_fscanf(lines[i], lens[i], &st1);
+    parse_task_stat(lines[i], lens[i], &st2);
+    if ((st1.state != st2.state) || (st1.utime != st2.utime) ||
+        (st1.stime != st2.stime) || (st1.processor != st2.processor)) {
+      mismatch++;
+      printf("differ: fscanf %c %lu %lu %d, parser %c %lu %lu %d: %s",
+             st1.state, st1.utime, st1.stime, st1.processor,
+             st2.state, st2.utime, st2.stime, st2.processor, lines[i]);
+    }
+  }
+
+  t0 = now();
+  for(j=0; j < iter; j++)
+    for(i=0; i < num_lines; i++) {
+      parse_fscanf(lines[i], lens[i], &st1);
+      sum += st1.utime;
+    }
+  t_scanf = now() - t0;
+
+  t0 = now();
+  for(j=0; j < iter; j++)
+    for(i=0; i < num_lines; i++) {
+      parse_task_stat(lines[i], lens[i], &st2);
+      sum += st2.utime;
+    }
+  t_parse = now() - t0;
+
+  printf("%d lines, %d iterations, %d mismatches (checksum %lu)\n",
+         num_lines, iter, mismatch, sum);
+  printf("fscanf:          %8.1f ns/line\n", 1e9 * t_scanf / (iter * num_lines));
+  printf("parse_task_stat: %8.1f ns/line\n", 1e9 * t_parse / (iter * num_lines));
+  return 0;
+}
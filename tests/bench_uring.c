@@ -0,0 +1,117 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "uring.h"
+
+/* Micro-benchmark of the reads of a refresh: N stat files read one by
+   one with pread (as in read_task_stat), and in batches with uring.c
+   (as with --uring). All handles are on /proc/self/stat, which costs
+   the same to generate as the stat file of any task. Sizes stop at the
+   files limit. The lengths read by both methods are checked.
+
+   gcc -O2 -I../src -I<build dir> bench_uring.c ../src/uring.c -o bench_uring
+   (uring.c includes config.h, generated by configure)
+   ./bench_uring [refreshes]
+*/
+
+#define BUF_LEN 512  /* STAT_BUF_LEN */
+
+static const int sizes[] = { 1000, 10000, 50000 };
+
+
+static double now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+int main(int argc, char* argv[])
+{
+  struct uring* ring;
+  struct rlimit rl;
+  char*  bufs;
+  int*   fds;
+  int*   res;
+  int    s, i, j, iter = 20, max_fds, mismatch = 0;
+  double t0, t_pread, t_uring;
+  unsigned long sum = 0, syscalls;
+
+  if (argc > 1)
+    iter = atoi(argv[1]);
+
+  getrlimit(RLIMIT_NOFILE, &rl);
+  rl.rlim_cur = rl.rlim_max;
+  setrlimit(RLIMIT_NOFILE, &rl);
+  max_fds = rl.rlim_cur - 10;
+
+  ring = uring_open(256);
+  if (!ring) {
+    fprintf(stderr, "io_uring not available\n");
+    return EXIT_FAILURE;
+  }
+
+  for(s = 0; s < (int)(sizeof(sizes) / sizeof(sizes[0])); s++) {
+    int n = sizes[s];
+    if (n > max_fds) {
+      printf("%6d files: over the files limit (%d), skipped\n", n, max_fds);
+      continue;
+    }
+
+    fds = malloc(n * sizeof(int));
+    res = malloc(n * sizeof(int));
+    bufs = malloc((size_t)n * BUF_LEN);
+    for(i = 0; i < n; i++)
+      fds[i] = open("/proc/self/stat", O_RDONLY);
+    if (uring_register_buffer(ring, bufs, (size_t)n * BUF_LEN) == -1)
+      printf("(buffer not registered, memory lock limit)\n");
+
+    t0 = now();
+    for(j = 0; j < iter; j++)
+      for(i = 0; i < n; i++)
+        sum += pread(fds[i], bufs + (size_t)i * BUF_LEN, BUF_LEN - 1, 0);
+    t_pread = now() - t0;
+
+    syscalls = uring_num_syscalls(ring);
+    t0 = now();
+    for(j = 0; j < iter; j++) {
+      for(i = 0; i < n; i++)
+        uring_read(ring, fds[i], bufs + (size_t)i * BUF_LEN, BUF_LEN - 1,
+                   &res[i]);
+      uring_wait(ring);
+      for(i = 0; i < n; i++)
+        sum += res[i];
+    }
+    t_uring = now() - t0;
+    syscalls = uring_num_syscalls(ring) - syscalls;
+
+    /* same lengths? (the content changes, e.g. utime) */
+    for(i = 0; i < n; i++) {
+      int r = pread(fds[i], bufs + (size_t)i * BUF_LEN, BUF_LEN - 1, 0);
+      if ((r <= 0) || (res[i] <= 0) || (r - res[i] > 4) || (res[i] - r > 4))
+        mismatch++;
+    }
+
+    printf("%6d files, %d refreshes, %d mismatches (checksum %lu)\n",
+           n, iter, mismatch, sum);
+    printf("  pread:   %8.1f ns/read, %8d syscalls/refresh\n",
+           1e9 * t_pread / ((double)iter * n), n);
+    printf("  io_uring:%8.1f ns/read, %8.1f syscalls/refresh\n",
+           1e9 * t_uring / ((double)iter * n), (double)syscalls / iter);
+
+    for(i = 0; i < n; i++)
+      close(fds[i]);
+    free(fds);
+    free(res);
+    free(bufs);
+  }
+
+  uring_close(ring);
+  return 0;
+}